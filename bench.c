@@ -0,0 +1,528 @@
+/*
+ *  Copyright (C) 2024 Nicolai Brand (https://lytix.dev)
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Benchmarks NAG on synthetic graphs. Every generator is seeded, so the same arguments always give the
+ * same graphs. Prints one CSV line per generator and operation, timed as the fastest of the runs.
+ * Memory is measured with the arena statistics of sac.
+ *
+ * usage: nag_bench [-g generator] [-n nodes] [-d degree] [-r runs] [-s seed] [-a arena policy] [-t threads] [-p]
+ */
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "nag.h"
+
+#define SAC_STATS
+#define SAC_IMPLEMENTATION
+#include "sac_single.h"
+
+/* Room for the largest graphs NAG_Idx can index. Only the pages used get committed */
+#define BENCH_MAX_PAGES ((size_t)1 << 22)
+
+typedef struct {
+    NAG_Idx n_nodes;
+    NAG_EdgeIdx n_edges;
+    NAG_Idx *from; // NOTE: Heap allocated
+    NAG_Idx *to;
+} EdgeList;
+
+typedef struct {
+    u64 state;
+} Rng;
+
+/* splitmix64 */
+static u64 rng_next(Rng *rng)
+{
+    u64 z = (rng->state += 0x9e3779b97f4a7c15);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+    return z ^ (z >> 31);
+}
+
+static NAG_Idx rng_below(Rng *rng, NAG_Idx n)
+{
+    return (NAG_Idx)(rng_next(rng) % n);
+}
+
+static EdgeList edge_list_make(NAG_Idx n_nodes, NAG_EdgeIdx max_edges)
+{
+    EdgeList edges = { .n_nodes = n_nodes, .n_edges = 0 };
+    edges.from = malloc(sizeof(NAG_Idx) * max_edges);
+    edges.to = malloc(sizeof(NAG_Idx) * max_edges);
+    return edges;
+}
+
+static inline void edge_list_add(EdgeList *edges, NAG_Idx from, NAG_Idx to)
+{
+    edges->from[edges->n_edges] = from;
+    edges->to[edges->n_edges] = to;
+    edges->n_edges++;
+}
+
+/* Gives the nodes random ids, like ids handed out in file discovery order, to take away any locality */
+static void edge_list_shuffle_ids(EdgeList *edges, Rng *rng)
+{
+    NAG_Idx *perm = malloc(sizeof(NAG_Idx) * edges->n_nodes);
+    for (NAG_Idx i = 0; i < edges->n_nodes; i++) {
+        perm[i] = i;
+    }
+    for (NAG_Idx i = edges->n_nodes - 1; i > 0; i--) {
+        NAG_Idx j = rng_below(rng, i + 1);
+        NAG_Idx swap = perm[i];
+        perm[i] = perm[j];
+        perm[j] = swap;
+    }
+    for (NAG_EdgeIdx e = 0; e < edges->n_edges; e++) {
+        edges->from[e] = perm[edges->from[e]];
+        edges->to[e] = perm[edges->to[e]];
+    }
+    free(perm);
+}
+
+/* Uniformly random edges, cycles included */
+static EdgeList gen_random(NAG_Idx n_nodes, u32 degree, Rng *rng)
+{
+    EdgeList edges = edge_list_make(n_nodes, (NAG_EdgeIdx)n_nodes * degree);
+    for (NAG_EdgeIdx e = 0; e < (NAG_EdgeIdx)n_nodes * degree; e++) {
+        edge_list_add(&edges, rng_below(rng, n_nodes), rng_below(rng, n_nodes));
+    }
+    return edges;
+}
+
+/*
+ * Preferential attachment. Every new node gets edges to degree older nodes, each picked as the
+ * endpoint of a random earlier edge, so popular nodes keep getting more popular.
+ */
+static EdgeList gen_powerlaw(NAG_Idx n_nodes, u32 degree, Rng *rng)
+{
+    EdgeList edges = edge_list_make(n_nodes, (NAG_EdgeIdx)n_nodes * degree);
+    for (NAG_Idx node = 1; node < n_nodes; node++) {
+        for (u32 i = 0; i < degree; i++) {
+            NAG_Idx target;
+            if (edges.n_edges == 0 || rng_next(rng) % 4 == 0) {
+                target = rng_below(rng, node);
+            } else {
+                target = edges.to[rng_next(rng) % edges.n_edges];
+            }
+            edge_list_add(&edges, node, target);
+        }
+    }
+    return edges;
+}
+
+/* Every node depends on the one before it */
+static EdgeList gen_chain(NAG_Idx n_nodes, u32 degree, Rng *rng)
+{
+    (void)degree;
+    (void)rng;
+    EdgeList edges = edge_list_make(n_nodes, n_nodes);
+    for (NAG_Idx node = 1; node < n_nodes; node++) {
+        edge_list_add(&edges, node, node - 1);
+    }
+    return edges;
+}
+
+/* A square grid with edges to the right and downwards */
+static EdgeList gen_grid(NAG_Idx n_nodes, u32 degree, Rng *rng)
+{
+    (void)degree;
+    (void)rng;
+    NAG_Idx side = 1;
+    while ((size_t)(side + 1) * (side + 1) <= n_nodes) {
+        side++;
+    }
+    EdgeList edges = edge_list_make(side * side, (NAG_EdgeIdx)side * side * 2);
+    for (NAG_Idx row = 0; row < side; row++) {
+        for (NAG_Idx col = 0; col < side; col++) {
+            NAG_Idx node = row * side + col;
+            if (col + 1 < side) {
+                edge_list_add(&edges, node, node + 1);
+            }
+            if (row + 1 < side) {
+                edge_list_add(&edges, node, node + side);
+            }
+        }
+    }
+    return edges;
+}
+
+/* Layers of about the square root of n_nodes, where every node depends on nodes of the next layer */
+static EdgeList gen_layered(NAG_Idx n_nodes, u32 degree, Rng *rng)
+{
+    NAG_Idx width = 1;
+    while ((size_t)(width + 1) * (width + 1) <= n_nodes) {
+        width++;
+    }
+    EdgeList edges = edge_list_make(n_nodes, (NAG_EdgeIdx)n_nodes * degree);
+    for (NAG_Idx node = 0; node < n_nodes; node++) {
+        NAG_Idx next_layer = (node / width + 1) * width;
+        if (next_layer >= n_nodes) {
+            continue;
+        }
+        NAG_Idx next_width = NAG_MIN(width, n_nodes - next_layer);
+        for (u32 i = 0; i < degree; i++) {
+            edge_list_add(&edges, node, next_layer + rng_below(rng, next_width));
+        }
+    }
+    return edges;
+}
+
+typedef EdgeList (*Generator)(NAG_Idx n_nodes, u32 degree, Rng *rng);
+
+static struct {
+    const char *name;
+    Generator gen;
+} generators[] = {
+    { "random", gen_random }, { "powerlaw", gen_powerlaw }, { "chain", gen_chain },
+    { "grid", gen_grid },     { "layered", gen_layered },
+};
+
+/* Commit policies of the persist and scratch arenas */
+static struct {
+    const char *name;
+    ArenaPolicy policy;
+} policies[] = {
+    { "exact", { 0 } },
+    { "chunk", { .min_commit_pages = 256 } },
+    { "geometric", { .geometric = true } },
+    { "huge", { .geometric = true, .huge_pages = true } },
+};
+
+typedef enum {
+    OP_BUILD_LIST, // nag_add_edge() for every edge, then nag_freeze()
+    OP_BUILD_CSR, // nag_make_graph_from_edges()
+    OP_BUILD_CONCURRENT, // nag_add_edge_concurrent() from n_threads threads, then nag_freeze()
+    OP_LOAD_EDGE_LIST, // nag_load_edge_list() on n_threads threads, from a text file in the page cache
+    OP_DFS,
+    OP_BFS,
+    OP_REV_TOPOSORT,
+    OP_SCC,
+    OP_DFS_FLAT,
+    OP_BFS_FLAT,
+    OP_SCC_FLAT,
+    OP_REORDER_BFS,
+    OP_REORDER_RCM,
+    OP_REORDER_DEGREE,
+    OP_DFS_RCM, // nag_dfs() on the graph renumbered by nag_reorder(), which is not timed
+    OP_SCC_RCM,
+    OP_COUNT,
+} Op;
+
+static const char *op_names[OP_COUNT] = {
+    "build_list", "build_csr", "build_concurrent", "load_edge_list", "dfs", "bfs", "rev_toposort", "scc",
+    "dfs_flat", "bfs_flat", "scc_flat", "reorder_bfs", "reorder_rcm", "reorder_degree", "dfs_rcm", "scc_rcm",
+};
+
+static u64 now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64)ts.tv_sec * 1000000000 + (u64)ts.tv_nsec;
+}
+
+static void free_order_list(NAG_OrderList list)
+{
+    free(list.orders);
+}
+
+typedef struct {
+    u64 ns;
+    size_t persist_bytes; // what the operation left on the persist arena
+    size_t scratch_bytes; // the peak of the scratch arena
+    size_t commits; // mprotect calls on both arenas
+} Sample;
+
+typedef struct {
+    NAG_EdgeInserter inserter;
+    Arena arena;
+    EdgeList *edges;
+    NAG_EdgeIdx begin;
+    NAG_EdgeIdx end;
+} Inserter;
+
+static void *insert_thread(void *arg)
+{
+    Inserter *ins = arg;
+    for (NAG_EdgeIdx e = ins->begin; e < ins->end; e++) {
+        nag_add_edge_concurrent(&ins->inserter, ins->edges->from[e], ins->edges->to[e]);
+    }
+    return NULL;
+}
+
+/* Every thread inserts a contiguous slice of the edges on its own arena, like parsers of separate files */
+static void build_concurrent(NAG_Graph *graph, EdgeList *edges, u32 n_threads, ArenaPolicy policy)
+{
+    Inserter *inserters = malloc(n_threads * sizeof(Inserter));
+    pthread_t *threads = malloc(n_threads * sizeof(pthread_t));
+    for (u32 i = 0; i < n_threads; i++) {
+        m_arena_init_dynamic(&inserters[i].arena, 0, BENCH_MAX_PAGES);
+        m_arena_set_policy(&inserters[i].arena, policy);
+        inserters[i].inserter = nag_make_edge_inserter(graph, &inserters[i].arena);
+        inserters[i].edges = edges;
+        inserters[i].begin = (NAG_EdgeIdx)((u64)edges->n_edges * i / n_threads);
+        inserters[i].end = (NAG_EdgeIdx)((u64)edges->n_edges * (i + 1) / n_threads);
+        pthread_create(&threads[i], NULL, insert_thread, &inserters[i]);
+    }
+    for (u32 i = 0; i < n_threads; i++) {
+        pthread_join(threads[i], NULL);
+        nag_finish_edge_inserter(&inserters[i].inserter);
+    }
+    nag_freeze(graph);
+    for (u32 i = 0; i < n_threads; i++) {
+        m_arena_release(&inserters[i].arena);
+    }
+    free(inserters);
+    free(threads);
+}
+
+/* The edge list of the current generator as text, for OP_LOAD_EDGE_LIST */
+static char edge_list_path[] = "/tmp/nag_bench_XXXXXX";
+
+static void write_edge_list(EdgeList *edges)
+{
+    FILE *file = fopen(edge_list_path, "w");
+    if (file == NULL) {
+        perror(edge_list_path);
+        exit(1);
+    }
+    for (NAG_EdgeIdx e = 0; e < edges->n_edges; e++) {
+        fprintf(file, "%llu %llu\n", (unsigned long long)edges->from[e], (unsigned long long)edges->to[e]);
+    }
+    fclose(file);
+}
+
+/*
+ * Runs op once on fresh arenas. The traversals run on a frozen graph built outside the timed region.
+ * The memory of the per-thread arenas of build_concurrent is not counted.
+ */
+static Sample run_op(Op op, EdgeList *edges, ArenaPolicy policy, u32 n_threads)
+{
+    Arena persist, scratch;
+    m_arena_init_dynamic(&persist, 0, BENCH_MAX_PAGES);
+    m_arena_init_dynamic(&scratch, 0, BENCH_MAX_PAGES);
+    m_arena_set_policy(&persist, policy);
+    m_arena_set_policy(&scratch, policy);
+
+    NAG_Graph graph = { 0 };
+    if (op != OP_BUILD_LIST && op != OP_BUILD_CSR && op != OP_BUILD_CONCURRENT && op != OP_LOAD_EDGE_LIST) {
+        /* Only touches the persist arena */
+        graph = nag_make_graph_from_edges(&persist, &scratch, edges->n_nodes, edges->from, edges->to,
+                                          edges->n_edges);
+    }
+    if (op == OP_DFS_RCM || op == OP_SCC_RCM) {
+        graph = nag_reorder(&graph, NAG_REORDER_RCM).graph;
+    }
+    size_t persist_before = persist.offset;
+    ArenaStats persist_stats = m_arena_stats_begin(&persist);
+    ArenaStats scratch_stats = m_arena_stats_begin(&scratch);
+
+    u64 start = now_ns();
+    switch (op) {
+    case OP_BUILD_LIST:
+        graph = nag_make_graph(&persist, &scratch, edges->n_nodes);
+        for (NAG_EdgeIdx e = 0; e < edges->n_edges; e++) {
+            nag_add_edge(&graph, edges->from[e], edges->to[e]);
+        }
+        nag_freeze(&graph);
+        break;
+    case OP_BUILD_CSR:
+        graph = nag_make_graph_from_edges(&persist, &scratch, edges->n_nodes, edges->from, edges->to,
+                                          edges->n_edges);
+        break;
+    case OP_BUILD_CONCURRENT:
+        graph = nag_make_graph(&persist, &scratch, edges->n_nodes);
+        build_concurrent(&graph, edges, n_threads, policy);
+        break;
+    case OP_LOAD_EDGE_LIST:
+        if (nag_load_edge_list(&persist, &scratch, edge_list_path, n_threads, &graph, NULL) != NAG_LOAD_OK) {
+            fprintf(stderr, "could not load %s\n", edge_list_path);
+            exit(1);
+        }
+        break;
+    case OP_DFS:
+        free_order_list(nag_dfs(&graph));
+        break;
+    case OP_BFS:
+        free_order_list(nag_bfs(&graph));
+        break;
+    case OP_REV_TOPOSORT:
+        nag_rev_toposort(&graph);
+        break;
+    case OP_SCC:
+        free_order_list(nag_scc(&graph));
+        break;
+    case OP_DFS_FLAT:
+        nag_dfs_flat(&graph, &persist);
+        break;
+    case OP_BFS_FLAT:
+        nag_bfs_flat(&graph, &persist);
+        break;
+    case OP_SCC_FLAT:
+        nag_scc_flat(&graph, &persist);
+        break;
+    case OP_REORDER_BFS:
+        nag_reorder(&graph, NAG_REORDER_BFS);
+        break;
+    case OP_REORDER_RCM:
+        nag_reorder(&graph, NAG_REORDER_RCM);
+        break;
+    case OP_REORDER_DEGREE:
+        nag_reorder(&graph, NAG_REORDER_DEGREE);
+        break;
+    case OP_DFS_RCM:
+        free_order_list(nag_dfs(&graph));
+        break;
+    case OP_SCC_RCM:
+        free_order_list(nag_scc(&graph));
+        break;
+    default:
+        break;
+    }
+    Sample sample = { .ns = now_ns() - start };
+
+    persist_stats = m_arena_stats_end(&persist, persist_stats);
+    scratch_stats = m_arena_stats_end(&scratch, scratch_stats);
+    sample.persist_bytes = persist.offset - persist_before;
+    sample.scratch_bytes = scratch_stats.peak_offset;
+    sample.commits = persist_stats.commits + scratch_stats.commits;
+    m_arena_release(&persist);
+    m_arena_release(&scratch);
+    return sample;
+}
+
+static void usage(const char *program)
+{
+    fprintf(stderr, "usage: %s [-g generator] [-n nodes] [-d degree] [-r runs] [-s seed] [-a arena policy] "
+                    "[-t threads] [-p]\n", program);
+    fprintf(stderr, "generators:");
+    for (size_t i = 0; i < sizeof(generators) / sizeof(generators[0]); i++) {
+        fprintf(stderr, " %s", generators[i].name);
+    }
+    fprintf(stderr, " (default: all)\narena policies:");
+    for (size_t i = 0; i < sizeof(policies) / sizeof(policies[0]); i++) {
+        fprintf(stderr, " %s", policies[i].name);
+    }
+    fprintf(stderr, " (default: exact)\n-p gives the nodes random ids\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    const char *only = NULL;
+    unsigned long long n_nodes = 100000;
+    u32 degree = 8;
+    u32 runs = 5;
+    u64 seed = 1;
+    u32 n_threads = 4;
+    bool shuffle = false;
+    ArenaPolicy policy = policies[0].policy;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "g:n:d:r:s:a:t:ph")) != -1) {
+        switch (opt) {
+        case 'g':
+            only = optarg;
+            break;
+        case 'n':
+            n_nodes = strtoull(optarg, NULL, 10);
+            break;
+        case 'd':
+            degree = (u32)strtoul(optarg, NULL, 10);
+            break;
+        case 'r':
+            runs = (u32)strtoul(optarg, NULL, 10);
+            break;
+        case 's':
+            seed = strtoull(optarg, NULL, 10);
+            break;
+        case 't':
+            n_threads = (u32)strtoul(optarg, NULL, 10);
+            break;
+        case 'p':
+            shuffle = true;
+            break;
+        case 'a': {
+            size_t i = 0;
+            while (i < sizeof(policies) / sizeof(policies[0]) && strcmp(optarg, policies[i].name) != 0) {
+                i++;
+            }
+            if (i == sizeof(policies) / sizeof(policies[0])) {
+                usage(argv[0]);
+            }
+            policy = policies[i].policy;
+            break;
+        }
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (n_nodes == 0 || n_nodes > NAG_IDX_MAX || runs == 0 || n_threads == 0) {
+        fprintf(stderr, "nodes must be in 1 .. %llu, and runs and threads at least 1. Build with -DNAG_IDX_BITS=32 "
+                        "for more nodes\n", (unsigned long long)NAG_IDX_MAX);
+        return 1;
+    }
+
+    int fd = mkstemp(edge_list_path);
+    if (fd == -1) {
+        perror("mkstemp");
+        return 1;
+    }
+    close(fd);
+
+    printf("generator,op,nodes,edges,ns,ns_per_edge,edges_per_sec,persist_bytes,scratch_bytes,commits\n");
+    bool found = false;
+    for (size_t g = 0; g < sizeof(generators) / sizeof(generators[0]); g++) {
+        if (only != NULL && strcmp(only, generators[g].name) != 0) {
+            continue;
+        }
+        found = true;
+        Rng rng = { .state = seed };
+        EdgeList edges = generators[g].gen((NAG_Idx)n_nodes, degree, &rng);
+        if (shuffle) {
+            edge_list_shuffle_ids(&edges, &rng);
+        }
+        write_edge_list(&edges);
+
+        for (Op op = 0; op < OP_COUNT; op++) {
+            Sample best = { .ns = UINT64_MAX };
+            for (u32 run = 0; run < runs; run++) {
+                Sample sample = run_op(op, &edges, policy, n_threads);
+                if (sample.ns < best.ns) {
+                    best = sample;
+                }
+            }
+            /* An edgeless graph still visits its nodes */
+            double per = edges.n_edges != 0 ? (double)edges.n_edges : 1.0;
+            printf("%s,%s,%llu,%llu,%llu,%.3f,%.0f,%zu,%zu,%zu\n", generators[g].name, op_names[op],
+                   (unsigned long long)edges.n_nodes, (unsigned long long)edges.n_edges,
+                   (unsigned long long)best.ns, best.ns / per, per * 1e9 / (best.ns != 0 ? best.ns : 1),
+                   best.persist_bytes, best.scratch_bytes, best.commits);
+        }
+
+        free(edges.from);
+        free(edges.to);
+    }
+    remove(edge_list_path);
+    if (!found) {
+        usage(argv[0]);
+    }
+    return 0;
+}
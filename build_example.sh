@@ -1,3 +1,5 @@
 #!/bin/sh
 
-gcc example.c nag.c -o nag_example -g
+gcc example.c nag.c -o nag_example -g -pthread
+gcc -DNAG_IDX_BITS=32 example.c nag.c -o nag_example32 -g -pthread
+gcc -O2 -DNAG_IDX_BITS=32 bench.c nag.c -o nag_bench -pthread
@@ -14,6 +14,9 @@
  *  You should have received a copy of the GNU General Public License
  *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
+#include <assert.h>
+#include <pthread.h>
+
 #include "nag.h"
 
 #define SAC_IMPLEMENTATION
@@ -22,8 +25,8 @@
 
 void nag_order_print(NAG_Order order)
 {
-    for (u32 i = 0; i < order.n_nodes; i++) {
-        printf("%d ", order.nodes[i]);
+    for (NAG_Idx i = 0; i < order.n_nodes; i++) {
+        printf("%llu ", (unsigned long long)order.nodes[i]);
     }
     printf("\n");
 }
@@ -56,11 +59,29 @@ void simple_dfs_bfs()
     printf("--- bfs ---\n");
     nag_order_print(bfs_order);
 
+    /* Repeated queries from different roots reuse the visited stamps instead of clearing them */
+    NAG_Query query = nag_make_query(&graph);
+    printf("--- dfs from 1, 4 and 6 ---\n");
+    nag_order_print(nag_query_dfs_from(&query, 1));
+    nag_order_print(nag_query_dfs_from(&query, 4));
+    nag_order_print(nag_query_dfs_from(&query, 6));
+
     m_arena_release(&persist);
     m_arena_release(&scratch);
 }
 
-void toposort()
+/* Stops the traversal at the first node with an id larger than the one given in ctx */
+bool find_larger(NAG_Idx node, NAG_VisitEvent event, void *ctx)
+{
+    NAG_Idx *threshold = ctx;
+    if (event == NAG_VISIT_DISCOVER && node > *threshold) {
+        *threshold = node;
+        return false;
+    }
+    return true;
+}
+
+void visitor()
 {
     Arena persist, scratch;
     m_arena_init_dynamic(&persist, 2, 4096);
@@ -69,6 +90,38 @@ void toposort()
     u32 n_nodes = 9;
     NAG_Graph graph = nag_make_graph(&persist, &scratch, n_nodes);
 
+    nag_add_edge(&graph, 0, 1);
+    nag_add_edge(&graph, 0, 4);
+    nag_add_edge(&graph, 1, 2);
+    nag_add_edge(&graph, 1, 6);
+    nag_add_edge(&graph, 2, 3);
+    nag_add_edge(&graph, 4, 5);
+    nag_add_edge(&graph, 4, 8);
+    nag_add_edge(&graph, 6, 7);
+
+    printf("--- reachability ---\n");
+    printf("0 -> 7: %d\n", nag_dfs_from_to(&graph, 0, 7));
+    printf("4 -> 7: %d\n", nag_bfs_from_to(&graph, 4, 7));
+
+    NAG_Query query = nag_make_query(&graph);
+    NAG_Idx found = 5;
+    bool stopped = nag_bfs_visit(&query, 0, find_larger, &found);
+    printf("--- first node larger than 5 in bfs from 0 ---\n");
+    printf("stopped: %d, node: %llu\n", stopped, (unsigned long long)found);
+
+    m_arena_release(&persist);
+    m_arena_release(&scratch);
+}
+
+void toposort()
+{
+    Arena persist, scratch;
+    m_arena_init_dynamic(&persist, 2, 4096);
+    m_arena_init_dynamic(&scratch, 2, 4096);
+
+    u32 n_nodes = 10;
+    NAG_Graph graph = nag_make_graph(&persist, &scratch, n_nodes);
+
     nag_add_edge(&graph, 0, 1);
     nag_add_edge(&graph, 0, 2);
     nag_add_edge(&graph, 1, 3);
@@ -95,13 +148,149 @@ void toposort()
     }
     free(r.orders);
 
-    r = nag_rev_toposort(&graph);
+    NAG_Order order = nag_rev_toposort(&graph);
     printf("--- reversed toposort ---\n");
-    for (u32 i = 0; i < r.n; i++) {
-        printf("[%d]: ", i);
-        nag_order_print(r.orders[i]);
+    nag_order_print(order);
+
+    m_arena_release(&persist);
+    m_arena_release(&scratch);
+}
+
+void topo_levels()
+{
+    Arena persist, scratch;
+    m_arena_init_dynamic(&persist, 2, 4096);
+    m_arena_init_dynamic(&scratch, 2, 4096);
+
+    /* A small build: two programs, 0 and 4, that both end up depending on the library 3 */
+    NAG_Idx from[] = { 0, 0, 1, 2, 3, 4, 4 };
+    NAG_Idx to[] = { 1, 2, 3, 3, 5, 3, 6 };
+    NAG_Graph graph = nag_make_graph_from_edges(&persist, &scratch, 7, from, to, sizeof(from) / sizeof(from[0]));
+
+    NAG_TopoLevels levels = nag_topo_levels(&graph);
+    printf("--- levels, critical path %llu, max width %llu ---\n", (unsigned long long)levels.n_levels,
+           (unsigned long long)levels.max_width);
+    for (NAG_Idx l = 0; l < levels.n_levels; l++) {
+        printf("[%llu]: ", (unsigned long long)l);
+        for (NAG_Idx i = levels.level_offsets[l]; i < levels.level_offsets[l + 1]; i++) {
+            printf("%llu ", (unsigned long long)levels.order.nodes[i]);
+        }
+        printf("\n");
     }
-    free(r.orders);
+
+    m_arena_release(&persist);
+    m_arena_release(&scratch);
+}
+
+void critical_path()
+{
+    Arena persist, scratch;
+    m_arena_init_dynamic(&persist, 2, 4096);
+    m_arena_init_dynamic(&scratch, 2, 4096);
+
+    /* Same build as in topo_levels(), weighted with compile times */
+    NAG_Idx from[] = { 0, 0, 1, 2, 3, 4, 4 };
+    NAG_Idx to[] = { 1, 2, 3, 3, 5, 3, 6 };
+    NAG_Graph graph = nag_make_graph_from_edges(&persist, &scratch, 7, from, to, sizeof(from) / sizeof(from[0]));
+    NAG_Weight cost[] = { 2, 5, 1, 3, 4, 1, 8 };
+    for (NAG_Idx node = 0; node < graph.n_nodes; node++) {
+        nag_set_node_weight(&graph, node, cost[node]);
+    }
+    /* Generating the headers of 5 takes a while before anything can use them */
+    nag_set_edge_weight(&graph, 3, 5, 2);
+
+    NAG_CriticalPath cp = nag_critical_path(&graph);
+    printf("--- critical path, length %llu ---\n", (unsigned long long)cp.length);
+    nag_order_print(cp.path);
+    printf("--- slack ---\n");
+    for (NAG_Idx node = 0; node < graph.n_nodes; node++) {
+        printf("%llu ", (unsigned long long)cp.slack[node]);
+    }
+    printf("\n");
+
+    m_arena_release(&persist);
+    m_arena_release(&scratch);
+}
+
+typedef struct {
+    NAG_Graph *graph;
+    _Atomic bool *built;
+    NAG_Idx broken; // the node whose build fails
+} BuildCtx;
+
+bool build(NAG_Idx node, void *ctx)
+{
+    BuildCtx *b = ctx;
+    /* Every dependency has been built before the node itself */
+    for (NAG_EdgeIdx e = b->graph->offsets[node]; e < b->graph->offsets[node + 1]; e++) {
+        assert(b->built[b->graph->targets[e]]);
+    }
+    if (node == b->broken) {
+        return false;
+    }
+    b->built[node] = true;
+    return true;
+}
+
+void execute()
+{
+    Arena persist, scratch;
+    m_arena_init_dynamic(&persist, 2, 4096);
+    m_arena_init_dynamic(&scratch, 2, 4096);
+
+    /* Same build as in topo_levels() */
+    NAG_Idx from[] = { 0, 0, 1, 2, 3, 4, 4 };
+    NAG_Idx to[] = { 1, 2, 3, 3, 5, 3, 6 };
+    NAG_Graph graph = nag_make_graph_from_edges(&persist, &scratch, 7, from, to, sizeof(from) / sizeof(from[0]));
+
+    _Atomic bool built[7] = { 0 };
+    BuildCtx ctx = { .graph = &graph, .built = built, .broken = NAG_UNDISCOVERED };
+    NAG_Execution result = nag_execute(&graph, 4, build, &ctx);
+    printf("--- execute ---\n");
+    printf("completed %llu of %llu\n", (unsigned long long)result.n_completed, (unsigned long long)graph.n_nodes);
+
+    /* Everything depending on the broken node, directly or not, is never started. Whether the
+       independent nodes still run depends on timing */
+    memset(built, 0, sizeof(built));
+    ctx.broken = 3;
+    result = nag_execute(&graph, 4, build, &ctx);
+    printf("--- execute, building 3 fails ---\n");
+    printf("failed %llu, app built: %s\n", (unsigned long long)result.failed, built[0] ? "yes" : "no");
+
+    m_arena_release(&persist);
+    m_arena_release(&scratch);
+}
+
+void dyn_toposort()
+{
+    Arena persist, scratch;
+    m_arena_init_dynamic(&persist, 2, 4096);
+    m_arena_init_dynamic(&scratch, 2, 4096);
+
+    u32 n_nodes = 5;
+    NAG_Graph graph = nag_make_graph(&persist, &scratch, n_nodes);
+    nag_add_edge(&graph, 0, 1);
+    nag_add_edge(&graph, 1, 2);
+
+    NAG_DynTopo topo = nag_make_dyn_topo(&graph);
+    printf("--- reversed toposort ---\n");
+    nag_order_print(topo.order);
+
+    /* Edges discovered one at a time only reorder the nodes between their endpoints */
+    nag_dyn_topo_add_edge(&topo, 2, 3);
+    nag_dyn_topo_add_edge(&topo, 4, 0);
+    printf("--- after 2 -> 3 and 4 -> 0 ---\n");
+    nag_order_print(topo.order);
+
+    bool added = nag_dyn_topo_add_edge(&topo, 3, 0);
+    printf("--- 3 -> 0 closes a cycle, added: %d ---\n", added);
+    nag_order_print(topo.order);
+
+    /* Without maintaining an order, the offending cycle can be had when inserting */
+    NAG_Order cycle;
+    added = nag_add_edge_checked(&graph, 3, 1, &cycle);
+    printf("--- 3 -> 1 added: %d, cycle ---\n", added);
+    nag_order_print(cycle);
 
     m_arena_release(&persist);
     m_arena_release(&scratch);
@@ -133,6 +322,45 @@ void scc()
         nag_order_print(r.orders[i]);
     }
     free(r.orders);
+
+    /* Same SCCs in one buffer on the persist arena, nothing to free */
+    NAG_FlatOrderList flat = nag_scc_flat(&graph, &persist);
+    printf("--- flat scc ---\n");
+    for (NAG_Idx i = 0; i < flat.n; i++) {
+        printf("[%llu]: ", (unsigned long long)i);
+        nag_order_print(nag_flat_order(&flat, i));
+    }
+
+    m_arena_release(&persist);
+    m_arena_release(&scratch);
+}
+
+void condense()
+{
+    Arena persist, scratch;
+    m_arena_init_dynamic(&persist, 2, 4096);
+    m_arena_init_dynamic(&scratch, 2, 4096);
+
+    /* Same graph as in Example 3 */
+    u32 n_nodes = 6;
+    NAG_Graph graph = nag_make_graph(&persist, &scratch, n_nodes);
+
+    nag_add_edge(&graph, 1, 4);
+    nag_add_edge(&graph, 4, 5);
+    nag_add_edge(&graph, 5, 4);
+
+    nag_add_edge(&graph, 0, 1);
+    nag_add_edge(&graph, 1, 2);
+    nag_add_edge(&graph, 2, 3);
+    nag_add_edge(&graph, 3, 1);
+
+    NAG_Condensation condensed = nag_condense(&graph);
+    printf("--- scc of each node ---\n");
+    NAG_Order components = { .n_nodes = n_nodes, .nodes = condensed.component };
+    nag_order_print(components);
+    printf("--- condensed dag, ids are leaf-first ---\n");
+    nag_print(&condensed.dag);
+
     m_arena_release(&persist);
     m_arena_release(&scratch);
 }
@@ -161,17 +389,581 @@ void scc2()
     m_arena_release(&scratch);
 }
 
+void frozen()
+{
+    Arena persist, scratch;
+    m_arena_init_dynamic(&persist, 2, 4096);
+    m_arena_init_dynamic(&scratch, 2, 4096);
+
+    u32 n_nodes = 6;
+    NAG_Graph graph = nag_make_graph(&persist, &scratch, n_nodes);
+
+    nag_add_edge(&graph, 0, 1);
+    nag_add_edge(&graph, 1, 2);
+    nag_add_edge(&graph, 2, 0);
+    nag_add_edge(&graph, 2, 3);
+    nag_add_edge(&graph, 3, 4);
+    nag_add_edge(&graph, 4, 5);
+    nag_add_edge(&graph, 5, 4);
+
+    /* Same results as on the unfrozen graph, but the traversals now scan contiguous arrays */
+    nag_freeze(&graph);
+    nag_print(&graph);
+
+    printf("--- dfs ---\n");
+    nag_order_print(nag_dfs_from(&graph, 0));
+    printf("--- bfs ---\n");
+    nag_order_print(nag_bfs_from(&graph, 0));
+
+    NAG_OrderList r = nag_scc(&graph);
+    printf("--- scc ---\n");
+    for (u32 i = 0; i < r.n; i++) {
+        printf("[%d]: ", i);
+        nag_order_print(r.orders[i]);
+    }
+    free(r.orders);
+
+    r = nag_scc_parallel(&graph, 2);
+    printf("--- parallel scc ---\n");
+    for (u32 i = 0; i < r.n; i++) {
+        printf("[%d]: ", i);
+        nag_order_print(r.orders[i]);
+    }
+    free(r.orders);
+
+    printf("--- shortest path 1 -> 5 ---\n");
+    nag_order_print(nag_shortest_path(&graph, 1, 5));
+
+    NAG_BfsLevels levels = nag_bfs_levels(&graph, 0);
+    printf("--- bfs levels ---\n");
+    for (NAG_Idx i = 0; i < levels.order.n_nodes; i++) {
+        NAG_Idx node = levels.order.nodes[i];
+        printf("%llu@%llu ", (unsigned long long)node, (unsigned long long)levels.depth[node]);
+    }
+    printf("\n");
+
+    levels = nag_bfs_parallel(&graph, 0, 4);
+    printf("--- parallel bfs depths ---\n");
+    for (NAG_Idx node = 0; node < graph.n_nodes; node++) {
+        printf("%llu ", (unsigned long long)levels.depth[node]);
+    }
+    printf("\n");
+
+    m_arena_release(&persist);
+    m_arena_release(&scratch);
+}
+
+typedef struct {
+    NAG_Query query;
+    NAG_Idx start;
+    NAG_Idx reached;
+} Session;
+
+void *session_thread(void *arg)
+{
+    Session *session = arg;
+    session->reached = nag_query_bfs_from(&session->query, session->start).n_nodes;
+    return NULL;
+}
+
+void concurrent_queries()
+{
+    Arena persist, scratch;
+    m_arena_init_dynamic(&persist, 2, 4096);
+    m_arena_init_dynamic(&scratch, 2, 4096);
+
+    NAG_Idx from[] = { 0, 0, 1, 2, 3, 4, 4 };
+    NAG_Idx to[] = { 1, 2, 3, 3, 5, 3, 6 };
+    NAG_Graph graph = nag_make_graph_from_edges(&persist, &scratch, 7, from, to, sizeof(from) / sizeof(from[0]));
+
+    /* Every session has its own query and arenas, so they can all read the graph at once */
+    Session sessions[4];
+    Arena session_arenas[4][2];
+    pthread_t threads[4];
+    for (u32 i = 0; i < 4; i++) {
+        m_arena_init_dynamic(&session_arenas[i][0], 2, 4096);
+        m_arena_init_dynamic(&session_arenas[i][1], 2, 4096);
+        sessions[i] = (Session){ .start = i, .query = nag_make_query_on(&graph, &session_arenas[i][0],
+                                                                        &session_arenas[i][1]) };
+    }
+    for (u32 i = 0; i < 4; i++) {
+        pthread_create(&threads[i], NULL, session_thread, &sessions[i]);
+    }
+    printf("--- nodes reached from 0, 1, 2 and 3 ---\n");
+    for (u32 i = 0; i < 4; i++) {
+        pthread_join(threads[i], NULL);
+        printf("%llu ", (unsigned long long)sessions[i].reached);
+        m_arena_release(&session_arenas[i][0]);
+        m_arena_release(&session_arenas[i][1]);
+    }
+    printf("\n");
+
+    m_arena_release(&persist);
+    m_arena_release(&scratch);
+}
+
+void snapshot()
+{
+    Arena persist, scratch;
+    m_arena_init_dynamic(&persist, 2, 4096);
+    m_arena_init_dynamic(&scratch, 2, 4096);
+
+    /* Same graph as in Example 5 */
+    NAG_Idx from[] = { 0, 1, 2, 2, 3, 4, 5 };
+    NAG_Idx to[] = { 1, 2, 0, 3, 4, 5, 4 };
+    NAG_Graph graph = nag_make_graph_from_edges(&persist, &scratch, 6, from, to, sizeof(from) / sizeof(from[0]));
+    if (!nag_save(&graph, "example.nag")) {
+        perror("nag_save");
+        return;
+    }
+
+    /* A later run would start here. The loaded graph reads its edges straight from the file */
+    NAG_Graph loaded;
+    NAG_LoadStatus status = nag_load_mmap(&persist, &scratch, "example.nag", true, &loaded);
+    if (status != NAG_LOAD_OK) {
+        printf("could not load example.nag: %d\n", status);
+        return;
+    }
+    printf("--- dfs ---\n");
+    nag_order_print(nag_dfs_from(&loaded, 0));
+    NAG_OrderList r = nag_scc(&loaded);
+    printf("--- scc ---\n");
+    for (u32 i = 0; i < r.n; i++) {
+        printf("[%d]: ", i);
+        nag_order_print(r.orders[i]);
+    }
+    free(r.orders);
+
+    nag_unmap(&loaded);
+    remove("example.nag");
+    m_arena_release(&persist);
+    m_arena_release(&scratch);
+}
+
+void from_edges()
+{
+    Arena persist, scratch;
+    m_arena_init_dynamic(&persist, 2, 4096);
+    m_arena_init_dynamic(&scratch, 2, 4096);
+
+    /* Same graph as in Example 1, built in one go. Neighbors keep the order of the input */
+    NAG_Idx from[] = { 0, 0, 1, 1, 2, 4, 4, 6 };
+    NAG_Idx to[] = { 1, 4, 2, 6, 3, 5, 8, 7 };
+    NAG_Graph graph = nag_make_graph_from_edges(&persist, &scratch, 9, from, to, sizeof(from) / sizeof(from[0]));
+    nag_print(&graph);
+
+    printf("--- dfs ---\n");
+    nag_order_print(nag_dfs_from(&graph, 0));
+    printf("--- bfs ---\n");
+    nag_order_print(nag_bfs_from(&graph, 0));
+
+    m_arena_release(&persist);
+    m_arena_release(&scratch);
+}
+
+typedef struct {
+    NAG_EdgeInserter inserter;
+    Arena arena;
+    NAG_Idx first;
+} Parser;
+
+void *parser_thread(void *arg)
+{
+    /* Every parser adds its own quarter of a chain 0 -> 1 -> ... -> 39, plus a shortcut to node 39 */
+    Parser *parser = arg;
+    for (NAG_Idx i = parser->first; i < parser->first + 10; i++) {
+        if (i + 1 < 40) {
+            nag_add_edge_concurrent(&parser->inserter, i, i + 1);
+        }
+        nag_add_edge_concurrent(&parser->inserter, i, 39);
+    }
+    return NULL;
+}
+
+void concurrent_insertion()
+{
+    Arena persist, scratch;
+    m_arena_init_dynamic(&persist, 2, 4096);
+    m_arena_init_dynamic(&scratch, 2, 4096);
+    NAG_Graph graph = nag_make_graph(&persist, &scratch, 40);
+
+    Parser parsers[4];
+    pthread_t threads[4];
+    for (u32 i = 0; i < 4; i++) {
+        m_arena_init_dynamic(&parsers[i].arena, 2, 4096);
+        parsers[i].inserter = nag_make_edge_inserter(&graph, &parsers[i].arena);
+        parsers[i].first = i * 10;
+        pthread_create(&threads[i], NULL, parser_thread, &parsers[i]);
+    }
+    for (u32 i = 0; i < 4; i++) {
+        pthread_join(threads[i], NULL);
+        nag_finish_edge_inserter(&parsers[i].inserter);
+    }
+    /* Freezing copies the edges off the parser arenas, so they can go. Neighbor order varies per run */
+    nag_freeze(&graph);
+    for (u32 i = 0; i < 4; i++) {
+        m_arena_release(&parsers[i].arena);
+    }
+
+    printf("--- edges, nodes reached from 0 and shortest path from 0 to 39 ---\n");
+    printf("%llu %llu\n", (unsigned long long)graph.n_edges, (unsigned long long)nag_bfs_from(&graph, 0).n_nodes);
+    nag_order_print(nag_shortest_path(&graph, 0, 39));
+
+    m_arena_release(&persist);
+    m_arena_release(&scratch);
+}
+
+void edge_list_file()
+{
+    Arena persist, scratch;
+    m_arena_init_dynamic(&persist, 2, 4096);
+    m_arena_init_dynamic(&scratch, 2, 4096);
+
+    /* Same graph as in Example 1, with a typo on the third edge */
+    FILE *file = fopen("example.txt", "w");
+    fputs("# from to\n0 1\n0 4\n1 2x\n1 6\n2 3\n4 5\n4 8\n6 7\n", file);
+    fclose(file);
+
+    NAG_Graph graph;
+    NAG_ParseErrors errors;
+    NAG_LoadStatus status = nag_load_edge_list(&persist, &scratch, "example.txt", 2, &graph, &errors);
+    printf("--- status %d, %llu malformed line(s), the first at byte %zu ---\n", status,
+           (unsigned long long)errors.n_lines, errors.first_offset);
+
+    file = fopen("example.txt", "w");
+    fputs("# from to\n0 1\n0 4\n1 2\n1 6\n2 3\n4 5\n4 8\n6 7\n", file);
+    fclose(file);
+    status = nag_load_edge_list(&persist, &scratch, "example.txt", 2, &graph, &errors);
+    if (status == NAG_LOAD_OK) {
+        nag_print(&graph);
+        printf("--- dfs ---\n");
+        nag_order_print(nag_dfs_from(&graph, 0));
+    }
+
+    remove("example.txt");
+    m_arena_release(&persist);
+    m_arena_release(&scratch);
+}
+
+void reorder()
+{
+    Arena persist, scratch;
+    m_arena_init_dynamic(&persist, 2, 4096);
+    m_arena_init_dynamic(&scratch, 2, 4096);
+
+    /* A chain 0 -> 1 -> ... -> 7 whose ids were handed out in no particular order */
+    NAG_Idx from[] = { 5, 2, 7, 0, 3, 6, 1 };
+    NAG_Idx to[] = { 2, 7, 0, 3, 6, 1, 4 };
+    NAG_Graph graph = nag_make_graph_from_edges(&persist, &scratch, 8, from, to, sizeof(from) / sizeof(from[0]));
+
+    NAG_Reordering rcm = nag_reorder(&graph, NAG_REORDER_RCM);
+    printf("--- old ids in rcm order ---\n");
+    nag_order_print((NAG_Order){ .n_nodes = graph.n_nodes, .nodes = rcm.old_id });
+    nag_print(&rcm.graph);
+
+    /* Traverse the renumbered graph, and map the result back to the old ids */
+    NAG_Order order = nag_dfs_from(&rcm.graph, rcm.new_id[5]);
+    for (NAG_Idx i = 0; i < order.n_nodes; i++) {
+        order.nodes[i] = rcm.old_id[order.nodes[i]];
+    }
+    printf("--- dfs from 5, in old ids ---\n");
+    nag_order_print(order);
+
+    m_arena_release(&persist);
+    m_arena_release(&scratch);
+}
+
+/* Labels every node with the lowest node of its non-trivial SCC, or NAG_UNDISCOVERED if it is in none */
+void scc_label(NAG_OrderList sccs, NAG_Idx n_nodes, NAG_Idx *label)
+{
+    memset(label, 0xff, sizeof(NAG_Idx) * n_nodes); /* NAG_UNDISCOVERED has all bits set */
+    for (u32 i = 0; i < sccs.n; i++) {
+        NAG_Idx lowest = NAG_UNDISCOVERED;
+        for (NAG_Idx j = 0; j < sccs.orders[i].n_nodes; j++) {
+            lowest = NAG_MIN(lowest, sccs.orders[i].nodes[j]);
+        }
+        for (NAG_Idx j = 0; j < sccs.orders[i].n_nodes; j++) {
+            assert(label[sccs.orders[i].nodes[j]] == NAG_UNDISCOVERED && "a node is in one scc");
+            label[sccs.orders[i].nodes[j]] = lowest;
+        }
+    }
+}
+
+/*
+ * Cross-checks nag_scc_parallel() against nag_scc() on a seeded random graph of clusters that only have
+ * edges to later clusters, so there are several large SCCs besides the small ones. It is large enough that
+ * the nodes left after trimming go through forward-backward splits before Tarjan takes over.
+ */
+void scc_random()
+{
+    Arena persist, scratch;
+    m_arena_init_dynamic(&persist, 2, 1 << 14);
+    m_arena_init_dynamic(&scratch, 2, 1 << 14);
+
+    NAG_Idx n_nodes = 20000;
+    NAG_Idx n_clusters = 4;
+    NAG_Idx cluster_size = n_nodes / n_clusters;
+    NAG_EdgeIdx n_edges = 2 * n_nodes;
+    NAG_Idx *from = m_arena_alloc(&persist, sizeof(NAG_Idx) * n_edges);
+    NAG_Idx *to = m_arena_alloc(&persist, sizeof(NAG_Idx) * n_edges);
+    srand(10);
+    for (NAG_EdgeIdx e = 0; e < n_edges; e++) {
+        from[e] = rand() % n_nodes;
+        NAG_Idx cluster = from[e] / cluster_size;
+        /* Mostly within the cluster, otherwise to a later one */
+        if (rand() % 8 != 0 || cluster == n_clusters - 1) {
+            to[e] = cluster * cluster_size + rand() % cluster_size;
+        } else {
+            to[e] = (cluster + 1) * cluster_size + rand() % (n_nodes - (cluster + 1) * cluster_size);
+        }
+    }
+    NAG_Graph graph = nag_make_graph_from_edges(&persist, &scratch, n_nodes, from, to, n_edges);
+
+    NAG_OrderList expected = nag_scc(&graph);
+    NAG_Idx *expected_label = m_arena_alloc(&persist, sizeof(NAG_Idx) * n_nodes);
+    NAG_Idx *label = m_arena_alloc(&persist, sizeof(NAG_Idx) * n_nodes);
+    scc_label(expected, n_nodes, expected_label);
+    size_t in_sccs = 0;
+    for (u32 i = 0; i < expected.n; i++) {
+        in_sccs += expected.orders[i].n_nodes;
+    }
+    assert(expected.n > 1 && in_sccs > NAG_SCC_TARJAN_THRESHOLD);
+    printf("--- parallel scc on a random graph of %llu nodes ---\n", (unsigned long long)n_nodes);
+    printf("%u non-trivial scc(s) of %zu nodes in total\n", expected.n, in_sccs);
+
+    /* The SCCs come in any order, but every node must end up with the same nodes */
+    u32 n_threads[] = { 2, 3, 5 };
+    for (u32 i = 0; i < sizeof(n_threads) / sizeof(n_threads[0]); i++) {
+        NAG_OrderList r = nag_scc_parallel(&graph, n_threads[i]);
+        assert(r.n == expected.n);
+        scc_label(r, n_nodes, label);
+        assert(memcmp(label, expected_label, sizeof(NAG_Idx) * n_nodes) == 0);
+        printf("%u threads: same as nag_scc()\n", n_threads[i]);
+        free(r.orders);
+    }
+    free(expected.orders);
+
+    m_arena_release(&persist);
+    m_arena_release(&scratch);
+}
+
+/*
+ * Cross-checks nag_bfs_parallel() against nag_bfs_levels() on a seeded random graph. Its levels are many
+ * times NAG_PARALLEL_CHUNK_SIZE, so the workers race for chunks of the frontier and for the visited bits.
+ */
+void bfs_random()
+{
+    Arena persist, scratch;
+    m_arena_init_dynamic(&persist, 2, 1 << 14);
+    m_arena_init_dynamic(&scratch, 2, 1 << 14);
+
+    NAG_Idx n_nodes = 20000;
+    NAG_EdgeIdx n_edges = 3 * n_nodes;
+    NAG_Idx *from = m_arena_alloc(&persist, sizeof(NAG_Idx) * n_edges);
+    NAG_Idx *to = m_arena_alloc(&persist, sizeof(NAG_Idx) * n_edges);
+    srand(9);
+    for (NAG_EdgeIdx e = 0; e < n_edges; e++) {
+        from[e] = rand() % n_nodes;
+        to[e] = rand() % n_nodes;
+    }
+    NAG_Graph graph = nag_make_graph_from_edges(&persist, &scratch, n_nodes, from, to, n_edges);
+
+    /* Start from a node that has edges */
+    NAG_Idx start = from[0];
+    NAG_BfsLevels expected = nag_bfs_levels(&graph, start);
+    NAG_Idx widest = 0;
+    for (NAG_Idx i = 0; i < expected.order.n_nodes;) {
+        NAG_Idx level_end = i;
+        while (level_end < expected.order.n_nodes
+               && expected.depth[expected.order.nodes[level_end]] == expected.depth[expected.order.nodes[i]]) {
+            level_end++;
+        }
+        widest = NAG_MAX(widest, level_end - i);
+        i = level_end;
+    }
+    assert(widest > 8 * NAG_PARALLEL_CHUNK_SIZE);
+    printf("--- parallel bfs on a random graph of %llu nodes ---\n", (unsigned long long)n_nodes);
+    printf("%llu nodes reached, the widest level has %llu\n", (unsigned long long)expected.order.n_nodes,
+           (unsigned long long)widest);
+
+    /* Nodes within a level come in any order, but every node must get the same depth */
+    u32 n_threads[] = { 2, 3, 4, 8 };
+    for (u32 i = 0; i < sizeof(n_threads) / sizeof(n_threads[0]); i++) {
+        NAG_BfsLevels levels = nag_bfs_parallel(&graph, start, n_threads[i]);
+        assert(levels.order.n_nodes == expected.order.n_nodes);
+        assert(memcmp(levels.depth, expected.depth, sizeof(NAG_Idx) * n_nodes) == 0);
+        printf("%u threads: same depths as nag_bfs_levels()\n", n_threads[i]);
+    }
+
+    m_arena_release(&persist);
+    m_arena_release(&scratch);
+}
+
+/*
+ * Runs nag_execute() on a seeded random DAG, large enough that the work stealing deques fill up and the
+ * workers steal from each other. build() asserts that every task runs after all of its neighbors.
+ */
+void execute_random()
+{
+    Arena persist, scratch;
+    m_arena_init_dynamic(&persist, 2, 1 << 14);
+    m_arena_init_dynamic(&scratch, 2, 1 << 14);
+
+    /* Every node depends on up to three lower nodes */
+    NAG_Idx n_nodes = 20000;
+    NAG_EdgeIdx n_edges = 0;
+    NAG_Idx *from = m_arena_alloc(&persist, sizeof(NAG_Idx) * 3 * n_nodes);
+    NAG_Idx *to = m_arena_alloc(&persist, sizeof(NAG_Idx) * 3 * n_nodes);
+    srand(15);
+    for (NAG_Idx node = 1; node < n_nodes; node++) {
+        for (u32 i = rand() % 4; i > 0; i--) {
+            from[n_edges] = node;
+            to[n_edges] = rand() % node;
+            n_edges++;
+        }
+    }
+    NAG_Graph graph = nag_make_graph_from_edges(&persist, &scratch, n_nodes, from, to, n_edges);
+
+    _Atomic bool *built = m_arena_alloc_zero(&persist, sizeof(_Atomic bool) * n_nodes);
+    BuildCtx ctx = { .graph = &graph, .built = built, .broken = NAG_UNDISCOVERED };
+    printf("--- execute a random DAG of %llu nodes ---\n", (unsigned long long)n_nodes);
+    u32 n_threads[] = { 2, 4, 8 };
+    for (u32 i = 0; i < sizeof(n_threads) / sizeof(n_threads[0]); i++) {
+        memset(built, 0, sizeof(_Atomic bool) * n_nodes);
+        NAG_Execution result = nag_execute(&graph, n_threads[i], build, &ctx);
+        assert(result.n_completed == n_nodes && result.failed == NAG_UNDISCOVERED);
+        printf("%u threads: completed all\n", n_threads[i]);
+    }
+
+    /* Once a task fails no new task starts, so the completed count is exactly the tasks that succeeded
+       before or alongside it. Nothing that depends on the broken node, directly or not, is ever built */
+    ctx.broken = n_nodes / 2;
+    for (u32 i = 0; i < sizeof(n_threads) / sizeof(n_threads[0]); i++) {
+        memset(built, 0, sizeof(_Atomic bool) * n_nodes);
+        NAG_Execution result = nag_execute(&graph, n_threads[i], build, &ctx);
+        assert(result.failed == ctx.broken);
+        NAG_EdgeIdx n_built = 0;
+        for (NAG_Idx node = 0; node < n_nodes; node++) {
+            n_built += built[node];
+        }
+        assert(!built[ctx.broken] && n_built == result.n_completed && n_built < n_nodes);
+        printf("%u threads: failed %llu\n", n_threads[i], (unsigned long long)result.failed);
+    }
+
+    m_arena_release(&persist);
+    m_arena_release(&scratch);
+}
+
+#if NAG_IDX_BITS > 16
+/*
+ * Stress test for nag_scc() on deep graphs. Needs a wider index type (see build_example.sh).
+ * A chain has no non-trivial SCCs, closing it into a ring makes the whole graph one SCC.
+ * Both would overflow the C stack with a recursive Tarjan.
+ */
+void scc_deep(bool ring)
+{
+    Arena persist, scratch;
+    m_arena_init_dynamic(&persist, 2, 1 << 16);
+    m_arena_init_dynamic(&scratch, 2, 1 << 16);
+
+    u32 n_nodes = 1000000;
+    NAG_Graph graph = nag_make_graph(&persist, &scratch, n_nodes);
+
+    for (u32 i = 0; i < n_nodes - 1; i++) {
+        nag_add_edge(&graph, i, i + 1);
+    }
+    if (ring) {
+        nag_add_edge(&graph, n_nodes - 1, 0);
+    }
+
+    NAG_OrderList r = nag_scc(&graph);
+    printf("--- scc on a %u node %s ---\n", n_nodes, ring ? "ring" : "chain");
+    printf("%u non-trivial scc(s)", r.n);
+    if (r.n == 1) {
+        printf(" of %llu nodes", (unsigned long long)r.orders[0].n_nodes);
+    }
+    printf("\n");
+    assert(r.n == (ring ? 1 : 0));
+    assert(!ring || r.orders[0].n_nodes == n_nodes);
+    free(r.orders);
+
+    nag_freeze(&graph);
+    r = nag_scc_parallel(&graph, 4);
+    printf("parallel: %u non-trivial scc(s)\n", r.n);
+    assert(r.n == (ring ? 1 : 0));
+    assert(!ring || r.orders[0].n_nodes == n_nodes);
+    free(r.orders);
+
+    m_arena_release(&persist);
+    m_arena_release(&scratch);
+}
+#endif
+
 int main(void)
 {
     printf("[Example 1]: dfs & bfs\n");
     simple_dfs_bfs();
 
+    printf("[Example 1b]: visitor\n");
+    visitor();
+
     printf("[Example 2]: reversed toposort\n");
     toposort();
 
+    printf("[Example 2b]: incremental reversed toposort\n");
+    dyn_toposort();
+
+    printf("[Example 2c] topological levels:\n");
+    topo_levels();
+
+    printf("[Example 2d] critical path:\n");
+    critical_path();
+
+    printf("[Example 2e] parallel execution:\n");
+    execute();
+
     printf("[Example 3] scc:\n");
     scc();
 
+    printf("[Example 3b] condensation:\n");
+    condense();
+
     printf("[Example 4] scc 2:\n");
     scc2();
+
+    printf("[Example 5] frozen graph:\n");
+    frozen();
+
+    printf("[Example 5b] concurrent queries:\n");
+    concurrent_queries();
+
+    printf("[Example 5c] snapshot:\n");
+    snapshot();
+
+    printf("[Example 6] graph from edge arrays:\n");
+    from_edges();
+
+    printf("[Example 6b] concurrent edge insertion:\n");
+    concurrent_insertion();
+
+    printf("[Example 6c] edge list file:\n");
+    edge_list_file();
+
+    printf("[Example 6d] renumbering:\n");
+    reorder();
+
+#if NAG_IDX_BITS > 16
+    printf("[Example 7] scc on deep graphs:\n");
+    scc_deep(false);
+    scc_deep(true);
+#endif
+
+    printf("[Example 8] parallel scc on a random graph:\n");
+    scc_random();
+
+    printf("[Example 8b] parallel bfs on a random graph:\n");
+    bfs_random();
+
+    printf("[Example 8c] parallel execution of a random DAG:\n");
+    execute_random();
 }
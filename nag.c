@@ -15,20 +15,29 @@
  *  along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 #include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <stddef.h>
 #include <string.h> // why the hell is memset here
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "nag.h"
 
-typedef NAG_Order (*GraphTraverse)(NAG_Graph *graph, NAG_Idx start_node, u8 *visited);
+typedef NAG_Order (*GraphTraverse)(NAG_Query *query, NAG_Idx start_node);
+typedef NAG_Idx (*GraphFill)(NAG_Query *query, NAG_Idx start_node, NAG_Idx *ordered, Arena *grow_arena);
 
 
 NAG_Graph nag_make_graph(Arena *persist, Arena *scratch, NAG_Idx n_nodes)
 {
     NAG_Graph graph = { 
                         .n_nodes = n_nodes, .scratch_arena = scratch, .persist_arena = persist,
-                        .neighbor_list = m_arena_alloc(persist, sizeof(NAG_GraphNode) * n_nodes ),
+                        .neighbor_list = m_arena_alloc_zero(persist, sizeof(NAG_GraphNode *) * n_nodes),
                       };
     return graph;
 }
@@ -36,6 +45,7 @@ NAG_Graph nag_make_graph(Arena *persist, Arena *scratch, NAG_Idx n_nodes)
 void nag_add_edge(NAG_Graph *graph, NAG_Idx from, NAG_Idx to)
 {
     assert(from <= graph->n_nodes);
+    assert(graph->targets == NULL && "can not add edges to a frozen graph");
     // NOTE: This is the most naive way we can add eges and probably quite poor for performance 
     //       I will improve this if/when it becomes noticable.
     NAG_GraphNode *first = graph->neighbor_list[from];
@@ -43,35 +53,766 @@ void nag_add_edge(NAG_Graph *graph, NAG_Idx from, NAG_Idx to)
     new_node->id = to;
     new_node->next = first;
     graph->neighbor_list[from] = new_node;
+    graph->n_edges++;
 }
 
+NAG_EdgeInserter nag_make_edge_inserter(NAG_Graph *graph, Arena *arena)
+{
+    assert(graph->targets == NULL && "can not add edges to a frozen graph");
+    return (NAG_EdgeInserter){ .graph = graph, .arena = arena, .n_edges = 0 };
+}
+
+void nag_add_edge_concurrent(NAG_EdgeInserter *inserter, NAG_Idx from, NAG_Idx to)
+{
+    assert(from < inserter->graph->n_nodes);
+    NAG_GraphNode *new_node = m_arena_alloc(inserter->arena, sizeof(NAG_GraphNode));
+    new_node->id = to;
+
+    /* Nodes are only ever pushed, never popped, so the head can not change under us and come back (ABA) */
+    _Atomic(NAG_GraphNode *) *head = (_Atomic(NAG_GraphNode *) *)&inserter->graph->neighbor_list[from];
+    NAG_GraphNode *first = atomic_load_explicit(head, memory_order_relaxed);
+    do {
+        new_node->next = first;
+    } while (!atomic_compare_exchange_weak_explicit(head, &first, new_node, memory_order_release,
+                                                    memory_order_relaxed));
+    inserter->n_edges++;
+}
+
+void nag_finish_edge_inserter(NAG_EdgeInserter *inserter)
+{
+    inserter->graph->n_edges += inserter->n_edges;
+    inserter->n_edges = 0;
+}
+
+void nag_freeze(NAG_Graph *graph)
+{
+    assert(graph->targets == NULL && "graph is already frozen");
+    graph->offsets = m_arena_alloc(graph->persist_arena, sizeof(NAG_EdgeIdx) * ((size_t)graph->n_nodes + 1));
+    graph->targets = m_arena_alloc_internal(graph->persist_arena, sizeof(NAG_Idx) * graph->n_edges,
+                                            sizeof(NAG_Idx), false);
+
+    NAG_EdgeIdx edge = 0;
+    for (NAG_Idx i = 0; i < graph->n_nodes; i++) {
+        graph->offsets[i] = edge;
+        for (NAG_GraphNode *n = graph->neighbor_list[i]; n != NULL; n = n->next) {
+            graph->targets[edge++] = n->id;
+        }
+    }
+    graph->offsets[graph->n_nodes] = edge;
+}
+
+NAG_Graph nag_make_graph_from_edges(Arena *persist, Arena *scratch, NAG_Idx n_nodes, const NAG_Idx *from,
+                                    const NAG_Idx *to, NAG_EdgeIdx n_edges)
+{
+    NAG_Graph graph = { .n_nodes = n_nodes, .n_edges = n_edges, .scratch_arena = scratch, .persist_arena = persist };
+
+    /* One allocation for both arrays. The targets follow the offsets, which have the stricter alignment */
+    size_t offsets_len = (size_t)n_nodes + 1;
+    void *csr = m_arena_alloc(persist, sizeof(NAG_EdgeIdx) * offsets_len + sizeof(NAG_Idx) * n_edges);
+    graph.offsets = csr;
+    graph.targets = (NAG_Idx *)(graph.offsets + offsets_len);
+    memset(graph.offsets, 0, sizeof(NAG_EdgeIdx) * offsets_len);
+
+    /* Pass 1: count the out-degree of each node into offsets[node + 1], then prefix sum into start offsets */
+    for (NAG_EdgeIdx e = 0; e < n_edges; e++) {
+        assert(from[e] < n_nodes && to[e] < n_nodes);
+        graph.offsets[from[e] + 1]++;
+    }
+    for (size_t i = 1; i < offsets_len; i++) {
+        graph.offsets[i] += graph.offsets[i - 1];
+    }
+
+    /*
+     * Pass 2: place each edge at the cursor of its source node. offsets[node] is used as the cursor,
+     * so afterwards it holds the start of node + 1 and everything is shifted back by one.
+     */
+    for (NAG_EdgeIdx e = 0; e < n_edges; e++) {
+        graph.targets[graph.offsets[from[e]]++] = to[e];
+    }
+    for (size_t i = offsets_len - 1; i > 0; i--) {
+        graph.offsets[i] = graph.offsets[i - 1];
+    }
+    graph.offsets[0] = 0;
+
+    return graph;
+}
+
+NAG_Graph nag_transpose(NAG_Graph *graph)
+{
+    assert(graph->targets != NULL && "graph must be frozen");
+    if (graph->rev_targets == NULL) {
+        size_t offsets_len = (size_t)graph->n_nodes + 1;
+        NAG_EdgeIdx *rev_offsets = m_arena_alloc_zero(graph->persist_arena, sizeof(NAG_EdgeIdx) * offsets_len);
+        NAG_Idx *rev_targets = m_arena_alloc_internal(graph->persist_arena, sizeof(NAG_Idx) * graph->n_edges,
+                                                      sizeof(NAG_Idx), false);
+
+        /* Counting sort on the target of each edge, same as in nag_make_graph_from_edges() */
+        for (NAG_EdgeIdx e = 0; e < graph->n_edges; e++) {
+            rev_offsets[graph->targets[e] + 1]++;
+        }
+        for (size_t i = 1; i < offsets_len; i++) {
+            rev_offsets[i] += rev_offsets[i - 1];
+        }
+        for (NAG_Idx from = 0; from < graph->n_nodes; from++) {
+            for (NAG_EdgeIdx e = graph->offsets[from]; e < graph->offsets[from + 1]; e++) {
+                rev_targets[rev_offsets[graph->targets[e]]++] = from;
+            }
+        }
+        for (size_t i = offsets_len - 1; i > 0; i--) {
+            rev_offsets[i] = rev_offsets[i - 1];
+        }
+        rev_offsets[0] = 0;
+
+        graph->rev_offsets = rev_offsets;
+        graph->rev_targets = rev_targets;
+    }
+
+    NAG_Graph transposed = *graph;
+    transposed.offsets = graph->rev_offsets;
+    transposed.targets = graph->rev_targets;
+    transposed.rev_offsets = graph->offsets;
+    transposed.rev_targets = graph->targets;
+    transposed.neighbor_list = NULL;
+    /* Only the original unmaps */
+    transposed.mapping = NULL;
+    /* The edges are in a different order */
+    transposed.edge_weights = NULL;
+    return transposed;
+}
+
+void nag_set_node_weight(NAG_Graph *graph, NAG_Idx node, NAG_Weight weight)
+{
+    assert(node < graph->n_nodes);
+    if (graph->node_weights == NULL) {
+        graph->node_weights = m_arena_alloc(graph->persist_arena, sizeof(NAG_Weight) * graph->n_nodes);
+        for (NAG_Idx i = 0; i < graph->n_nodes; i++) {
+            graph->node_weights[i] = 1;
+        }
+    }
+    graph->node_weights[node] = weight;
+}
+
+void nag_set_edge_weight(NAG_Graph *graph, NAG_Idx from, NAG_Idx to, NAG_Weight weight)
+{
+    assert(graph->targets != NULL && "graph must be frozen");
+    assert(from < graph->n_nodes);
+    if (graph->edge_weights == NULL) {
+        graph->edge_weights = m_arena_alloc_zero(graph->persist_arena, sizeof(NAG_Weight) * graph->n_edges);
+    }
+    for (NAG_EdgeIdx e = graph->offsets[from]; e < graph->offsets[from + 1]; e++) {
+        if (graph->targets[e] == to) {
+            graph->edge_weights[e] = weight;
+            return;
+        }
+    }
+    assert(false && "no such edge");
+}
+
+/*
+ * Walks the neighbors of a node. On a frozen graph this is a sequential scan over a slice of
+ * graph->targets, otherwise it follows the linked adjacency list.
+ */
+typedef struct {
+    NAG_Idx *csr;
+    NAG_Idx *csr_end;
+    NAG_GraphNode *list;
+} NAG_NeighborIter;
+
+static inline NAG_NeighborIter nag_neighbors(NAG_Graph *graph, NAG_Idx node)
+{
+    if (graph->targets != NULL) {
+        return (NAG_NeighborIter){ .csr = graph->targets + graph->offsets[node],
+                                   .csr_end = graph->targets + graph->offsets[node + 1] };
+    }
+    return (NAG_NeighborIter){ .list = graph->neighbor_list[node] };
+}
+
+static inline bool nag_next_neighbor(NAG_NeighborIter *it, NAG_Idx *neighbor)
+{
+    if (it->csr != NULL) {
+        if (it->csr == it->csr_end) {
+            return false;
+        }
+        *neighbor = *it->csr++;
+        return true;
+    }
+    if (it->list == NULL) {
+        return false;
+    }
+    *neighbor = it->list->id;
+    it->list = it->list->next;
+    return true;
+}
+
+/*
+ * One frame per node on the current DFS path. The neighbor iterator is kept in the frame so the
+ * scan over a node's neighbors can resume when the DFS returns to it.
+ */
+typedef struct {
+    NAG_Idx node;
+    NAG_NeighborIter it;
+} NAG_DfsFrame;
+
 void nag_print(NAG_Graph *graph)
 {
     for (NAG_Idx i = 0; i < graph->n_nodes; i++) {
-        printf("[%d] -> ", i);
-        NAG_GraphNode *node = graph->neighbor_list[i];
-        while (node != NULL) {
-            printf("%d, ", node->id);
-            node = node->next;
+        printf("[%llu] -> ", (unsigned long long)i);
+        NAG_NeighborIter it = nag_neighbors(graph, i);
+        NAG_Idx neighbor;
+        while (nag_next_neighbor(&it, &neighbor)) {
+            printf("%llu, ", (unsigned long long)neighbor);
         }
         putchar('\n');
     }
 }
 
+/*
+ * On disk header of a snapshot. Written and read in native byte order, so byte_order only ever
+ * reads back as NAG_SNAPSHOT_BYTE_ORDER on a machine with the same endianness as the writer.
+ */
+typedef struct {
+    char magic[8];
+    u32 version;
+    u32 byte_order;
+    u8 idx_bits;
+    u8 edge_idx_bits;
+    u8 reserved[6];
+    u64 n_nodes;
+    u64 n_edges;
+    u64 targets_pos; // file position of the targets. The offsets start right after the header
+    u64 payload_checksum; // of the offsets and then the targets
+    u64 header_checksum; // of everything above
+} NAG_SnapshotHeader;
+
+_Static_assert(sizeof(NAG_SnapshotHeader) == 64, "snapshot header must be 64 bytes");
+
+#define NAG_SNAPSHOT_BYTE_ORDER 0x01020304u
+#define NAG_CHECKSUM_SEED 0xcbf29ce484222325ull
+
+/*
+ * FNV-1a taken a word at a time, with a shift so the high bits of a word also reach the low bits of
+ * the hash. Only meant to catch truncated or damaged files, not tampering.
+ */
+static u64 nag_checksum(const void *data, size_t len, u64 hash)
+{
+    const u8 *bytes = data;
+    size_t i = 0;
+    for (; i + sizeof(u64) <= len; i += sizeof(u64)) {
+        u64 word;
+        memcpy(&word, bytes + i, sizeof(u64));
+        hash = (hash ^ word) * 0x100000001b3ull;
+        hash ^= hash >> 32;
+    }
+    for (; i < len; i++) {
+        hash = (hash ^ bytes[i]) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+/* The targets start at the first multiple of 8 after the offsets */
+static u64 nag_snapshot_targets_pos(u64 n_nodes)
+{
+    u64 offsets_end = sizeof(NAG_SnapshotHeader) + sizeof(NAG_EdgeIdx) * (n_nodes + 1);
+    return (offsets_end + 7) & ~(u64)7;
+}
+
+bool nag_save(NAG_Graph *graph, const char *path)
+{
+    assert(graph->targets != NULL && "graph must be frozen");
+    size_t offsets_size = sizeof(NAG_EdgeIdx) * ((size_t)graph->n_nodes + 1);
+    size_t targets_size = sizeof(NAG_Idx) * graph->n_edges;
+
+    NAG_SnapshotHeader header = { .version = NAG_SNAPSHOT_VERSION,
+                                  .byte_order = NAG_SNAPSHOT_BYTE_ORDER,
+                                  .idx_bits = NAG_IDX_BITS,
+                                  .edge_idx_bits = NAG_EDGE_IDX_BITS,
+                                  .n_nodes = graph->n_nodes,
+                                  .n_edges = graph->n_edges,
+                                  .targets_pos = nag_snapshot_targets_pos(graph->n_nodes) };
+    memcpy(header.magic, NAG_SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.payload_checksum = nag_checksum(graph->offsets, offsets_size, NAG_CHECKSUM_SEED);
+    header.payload_checksum = nag_checksum(graph->targets, targets_size, header.payload_checksum);
+    header.header_checksum = nag_checksum(&header, offsetof(NAG_SnapshotHeader, header_checksum), NAG_CHECKSUM_SEED);
+    size_t padding = header.targets_pos - sizeof(header) - offsets_size;
+
+    ArenaTmp tmp_arena = m_arena_tmp_init(graph->scratch_arena);
+    size_t path_len = strlen(path);
+    char *tmp_path = m_arena_alloc(graph->scratch_arena, path_len + sizeof(".tmp"));
+    memcpy(tmp_path, path, path_len);
+    memcpy(tmp_path + path_len, ".tmp", sizeof(".tmp"));
+
+    bool ok = false;
+    FILE *file = fopen(tmp_path, "wb");
+    if (file != NULL) {
+        static const u8 zeros[8] = { 0 };
+        ok = fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(graph->offsets, offsets_size, 1, file) == 1 &&
+             (padding == 0 || fwrite(zeros, padding, 1, file) == 1) &&
+             (targets_size == 0 || fwrite(graph->targets, targets_size, 1, file) == 1);
+        /* fclose() flushes, so it can fail too */
+        ok = fclose(file) == 0 && ok;
+        ok = ok && rename(tmp_path, path) == 0;
+        if (!ok) {
+            int error = errno;
+            remove(tmp_path);
+            errno = error;
+        }
+    }
+    m_arena_tmp_release(tmp_arena);
+    return ok;
+}
+
+static NAG_LoadStatus nag_check_snapshot(const u8 *file, size_t size, bool verify)
+{
+    const NAG_SnapshotHeader *header = (const NAG_SnapshotHeader *)file;
+    if (size < sizeof(NAG_SnapshotHeader) || memcmp(header->magic, NAG_SNAPSHOT_MAGIC, sizeof(header->magic)) != 0) {
+        return NAG_LOAD_NOT_A_SNAPSHOT;
+    }
+    if (header->version != NAG_SNAPSHOT_VERSION) {
+        return NAG_LOAD_WRONG_VERSION;
+    }
+    if (header->byte_order != NAG_SNAPSHOT_BYTE_ORDER || header->idx_bits != NAG_IDX_BITS ||
+        header->edge_idx_bits != NAG_EDGE_IDX_BITS) {
+        return NAG_LOAD_WRONG_LAYOUT;
+    }
+    u64 header_checksum = nag_checksum(header, offsetof(NAG_SnapshotHeader, header_checksum), NAG_CHECKSUM_SEED);
+    if (header->header_checksum != header_checksum) {
+        return NAG_LOAD_CORRUPT;
+    }
+
+    /* Compare against what fits in the file before multiplying, so a bogus count can not overflow */
+    size_t payload = size - sizeof(NAG_SnapshotHeader);
+    if (header->n_nodes > NAG_IDX_MAX || header->n_nodes >= payload / sizeof(NAG_EdgeIdx) ||
+        header->targets_pos != nag_snapshot_targets_pos(header->n_nodes) || header->targets_pos > size ||
+        header->n_edges > (size - header->targets_pos) / sizeof(NAG_Idx) ||
+        header->n_edges != (NAG_EdgeIdx)header->n_edges) {
+        return NAG_LOAD_CORRUPT;
+    }
+    if (!verify) {
+        return NAG_LOAD_OK;
+    }
+
+    const NAG_EdgeIdx *offsets = (const NAG_EdgeIdx *)(file + sizeof(NAG_SnapshotHeader));
+    const NAG_Idx *targets = (const NAG_Idx *)(file + header->targets_pos);
+    size_t offsets_size = sizeof(NAG_EdgeIdx) * (header->n_nodes + 1);
+    u64 checksum = nag_checksum(offsets, offsets_size, NAG_CHECKSUM_SEED);
+    checksum = nag_checksum(targets, sizeof(NAG_Idx) * header->n_edges, checksum);
+    if (checksum != header->payload_checksum) {
+        return NAG_LOAD_CORRUPT;
+    }
+
+    /* The checksum only tells the file is as written. A CSR that was broken when saved is caught here */
+    if (offsets[0] != 0 || offsets[header->n_nodes] != header->n_edges) {
+        return NAG_LOAD_CORRUPT;
+    }
+    for (u64 i = 0; i < header->n_nodes; i++) {
+        if (offsets[i] > offsets[i + 1]) {
+            return NAG_LOAD_CORRUPT;
+        }
+    }
+    for (u64 e = 0; e < header->n_edges; e++) {
+        if (targets[e] >= header->n_nodes) {
+            return NAG_LOAD_CORRUPT;
+        }
+    }
+    return NAG_LOAD_OK;
+}
+
+NAG_LoadStatus nag_load_mmap(Arena *persist, Arena *scratch, const char *path, bool verify, NAG_Graph *graph)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return NAG_LOAD_IO_ERROR;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        return NAG_LOAD_IO_ERROR;
+    }
+    size_t size = (size_t)st.st_size;
+    if (size < sizeof(NAG_SnapshotHeader)) {
+        close(fd);
+        return NAG_LOAD_NOT_A_SNAPSHOT;
+    }
+    /* The mapping keeps the file alive, so the descriptor is not needed past this */
+    u8 *file = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    int error = errno;
+    close(fd);
+    if (file == MAP_FAILED) {
+        errno = error;
+        return NAG_LOAD_IO_ERROR;
+    }
+
+    NAG_LoadStatus status = nag_check_snapshot(file, size, verify);
+    if (status != NAG_LOAD_OK) {
+        munmap(file, size);
+        return status;
+    }
+    const NAG_SnapshotHeader *header = (const NAG_SnapshotHeader *)file;
+    *graph = (NAG_Graph){ .n_nodes = (NAG_Idx)header->n_nodes,
+                          .n_edges = (NAG_EdgeIdx)header->n_edges,
+                          .offsets = (NAG_EdgeIdx *)(file + sizeof(NAG_SnapshotHeader)),
+                          .targets = (NAG_Idx *)(file + header->targets_pos),
+                          .mapping = file,
+                          .mapping_size = size,
+                          .scratch_arena = scratch,
+                          .persist_arena = persist };
+    return NAG_LOAD_OK;
+}
+
+void nag_unmap(NAG_Graph *graph)
+{
+    assert(graph->mapping != NULL && "graph was not loaded by nag_load_mmap()");
+    munmap(graph->mapping, graph->mapping_size);
+    graph->mapping = NULL;
+    graph->offsets = NULL;
+    graph->targets = NULL;
+}
+
+/*
+ * Reserves room for max_bytes on an arena owned by a single thread. Only the pages used get committed,
+ * geometrically as workers grow their output one node at a time.
+ */
+static void nag_thread_arena_init(Arena *arena, size_t max_bytes)
+{
+    size_t page_size = sysconf(_SC_PAGE_SIZE);
+    m_arena_init_dynamic(arena, 1, max_bytes / page_size + 2);
+    m_arena_set_policy(arena, (ArenaPolicy){ .geometric = true });
+}
+
+typedef struct {
+    pthread_t thread;
+    pthread_mutex_t *gate;
+    void *(*worker)(void *);
+    void *arg;
+} NAG_WorkerThread;
+
+static void *nag_gated_worker(void *arg)
+{
+    NAG_WorkerThread *self = arg;
+    /* Held by the starting thread until everything is sized for the workers that actually started */
+    pthread_mutex_lock(self->gate);
+    pthread_mutex_unlock(self->gate);
+    return self->worker(self->arg);
+}
+
+/*
+ * Starts worker on threads 1 .. n_threads - 1 with args[t], arg_size bytes apart, and returns the number
+ * of workers counting the calling thread, which is worker 0. Stops at the first thread that can not be
+ * created (e.g. RLIMIT_NPROC), so running out of threads means fewer workers instead of a barrier that
+ * never fills up. The caller must hold gate, and releases it once its barriers and work split are sized
+ * for the returned count.
+ */
+static u32 nag_start_workers(pthread_mutex_t *gate, NAG_WorkerThread *threads, u32 n_threads,
+                             void *(*worker)(void *), void *args, size_t arg_size)
+{
+    u32 n_workers = 1;
+    for (; n_workers < n_threads; n_workers++) {
+        NAG_WorkerThread *thread = &threads[n_workers];
+        *thread = (NAG_WorkerThread){ .gate = gate, .worker = worker, .arg = (u8 *)args + arg_size * n_workers };
+        if (pthread_create(&thread->thread, NULL, nag_gated_worker, thread) != 0) {
+            break;
+        }
+    }
+    return n_workers;
+}
+
+static void nag_join_workers(NAG_WorkerThread *threads, u32 n_workers)
+{
+    for (u32 t = 1; t < n_workers; t++) {
+        pthread_join(threads[t].thread, NULL);
+    }
+}
+
+/* Per-thread state. Lines that start in begin .. end - 1 belong to the chunk */
+typedef struct {
+    size_t begin;
+    size_t end;
+    size_t n_lines; // upper bound on the edges in the chunk, so it knows where to write them
+    size_t base; // where the edges of the chunk go in from and to
+    size_t n_edges;
+    u64 max_node;
+    u64 n_malformed;
+    size_t first_malformed;
+} NAG_EdgeListChunk;
+
+typedef struct {
+    const u8 *file;
+    NAG_Idx *from;
+    NAG_Idx *to;
+    Arena *scratch_arena;
+    pthread_barrier_t barrier;
+    u32 n_threads;
+    NAG_EdgeListChunk *chunks;
+} NAG_EdgeListParse;
+
+typedef struct {
+    NAG_EdgeListParse *parse;
+    u32 id;
+} NAG_EdgeListWorkerArg;
+
+static size_t nag_count_lines(const u8 *begin, const u8 *end)
+{
+    /* memchr() is vectorized by libc, which beats testing a byte at a time */
+    size_t n_lines = 0;
+    while (begin < end && (begin = memchr(begin, '\n', end - begin)) != NULL) {
+        begin++;
+        n_lines++;
+    }
+    return n_lines;
+}
+
+/*
+ * Parses a decimal node index at p. The loop has no branches besides the digit test, overflow is
+ * remembered instead of checked for. Returns false if there were no digits or the value does not fit.
+ */
+static bool nag_parse_idx(const u8 **p, const u8 *end, u64 *value)
+{
+    const u8 *start = *p;
+    const u8 *c = start;
+    u64 v = 0;
+    bool overflow = false;
+    while (c < end && (u8)(*c - '0') < 10) {
+        overflow |= v > (U64_MAX - 9) / 10;
+        v = v * 10 + (u8)(*c - '0');
+        c++;
+    }
+    *p = c;
+    *value = v;
+    /* NAG_IDX_MAX is NAG_UNDISCOVERED, and n_nodes = max index + 1 must fit */
+    return c != start && !overflow && v < NAG_IDX_MAX;
+}
+
+static const u8 *nag_skip_blanks(const u8 *c, const u8 *end)
+{
+    while (c < end && (*c == ' ' || *c == '\t' || *c == '\r')) {
+        c++;
+    }
+    return c;
+}
+
+static void nag_parse_edge_chunk(NAG_EdgeListParse *parse, NAG_EdgeListChunk *chunk)
+{
+    const u8 *c = parse->file + chunk->begin;
+    const u8 *end = parse->file + chunk->end;
+    NAG_Idx *from = parse->from + chunk->base;
+    NAG_Idx *to = parse->to + chunk->base;
+
+    while (c < end) {
+        const u8 *line = c;
+        c = nag_skip_blanks(c, end);
+        bool ok = true;
+        if (c < end && *c != '\n' && *c != '#') {
+            u64 a, b;
+            ok = nag_parse_idx(&c, end, &a);
+            /* At least one blank between the indices */
+            const u8 *blanks = c;
+            c = nag_skip_blanks(c, end);
+            ok = ok && c != blanks && nag_parse_idx(&c, end, &b);
+            c = nag_skip_blanks(c, end);
+            ok = ok && (c == end || *c == '\n');
+            if (ok) {
+                from[chunk->n_edges] = (NAG_Idx)a;
+                to[chunk->n_edges] = (NAG_Idx)b;
+                chunk->n_edges++;
+                chunk->max_node = NAG_MAX(chunk->max_node, NAG_MAX(a, b));
+            }
+        }
+        if (!ok) {
+            if (chunk->n_malformed == 0) {
+                chunk->first_malformed = line - parse->file;
+            }
+            chunk->n_malformed++;
+        }
+        /* Skip the rest of the line, which is only more than the newline for comments and errors */
+        const u8 *newline = c < end && *c == '\n' ? c : memchr(c, '\n', end - c);
+        c = newline != NULL ? newline + 1 : end;
+    }
+}
+
+static void *nag_edge_list_worker(void *arg)
+{
+    NAG_EdgeListParse *parse = ((NAG_EdgeListWorkerArg *)arg)->parse;
+    u32 id = ((NAG_EdgeListWorkerArg *)arg)->id;
+    NAG_EdgeListChunk *self = &parse->chunks[id];
+
+    /* Count the lines to find where the edges of every chunk go, then parse in place */
+    self->n_lines = nag_count_lines(parse->file + self->begin, parse->file + self->end) + 1;
+    pthread_barrier_wait(&parse->barrier);
+    if (id == 0) {
+        size_t base = 0;
+        for (u32 t = 0; t < parse->n_threads; t++) {
+            parse->chunks[t].base = base;
+            base += parse->chunks[t].n_lines;
+        }
+        parse->from = m_arena_alloc_internal(parse->scratch_arena, sizeof(NAG_Idx) * base, sizeof(NAG_Idx), false);
+        parse->to = m_arena_alloc_internal(parse->scratch_arena, sizeof(NAG_Idx) * base, sizeof(NAG_Idx), false);
+    }
+    pthread_barrier_wait(&parse->barrier);
+    nag_parse_edge_chunk(parse, self);
+    return NULL;
+}
+
+NAG_LoadStatus nag_load_edge_list(Arena *persist, Arena *scratch, const char *path, u32 n_threads, NAG_Graph *graph,
+                                  NAG_ParseErrors *errors)
+{
+    if (n_threads == 0) {
+        n_threads = 1;
+    }
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return NAG_LOAD_IO_ERROR;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        return NAG_LOAD_IO_ERROR;
+    }
+    size_t size = (size_t)st.st_size;
+    /* Mapping nothing is an error, and an empty file is just an empty graph */
+    if (size == 0) {
+        close(fd);
+        if (errors != NULL) {
+            *errors = (NAG_ParseErrors){ 0 };
+        }
+        *graph = nag_make_graph_from_edges(persist, scratch, 0, NULL, NULL, 0);
+        return NAG_LOAD_OK;
+    }
+    const u8 *file = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    int error = errno;
+    close(fd);
+    if (file == MAP_FAILED) {
+        errno = error;
+        return NAG_LOAD_IO_ERROR;
+    }
+    madvise((void *)file, size, MADV_SEQUENTIAL);
+
+    ArenaTmp tmp_arena = m_arena_tmp_init(scratch);
+    NAG_EdgeListParse parse = { .file = file, .scratch_arena = scratch, .n_threads = n_threads };
+    parse.chunks = m_arena_alloc_zero(scratch, sizeof(NAG_EdgeListChunk) * n_threads);
+    NAG_EdgeListWorkerArg *args = m_arena_alloc(scratch, sizeof(NAG_EdgeListWorkerArg) * n_threads);
+    NAG_WorkerThread *threads = m_arena_alloc(scratch, sizeof(NAG_WorkerThread) * n_threads);
+    for (u32 t = 0; t < n_threads; t++) {
+        args[t] = (NAG_EdgeListWorkerArg){ .parse = &parse, .id = t };
+    }
+
+    /* The calling thread is worker 0. The file is split between the workers that actually started */
+    pthread_mutex_t gate = PTHREAD_MUTEX_INITIALIZER;
+    pthread_mutex_lock(&gate);
+    parse.n_threads = nag_start_workers(&gate, threads, n_threads, nag_edge_list_worker, args,
+                                        sizeof(NAG_EdgeListWorkerArg));
+
+    /* Equal byte ranges, with every boundary moved to just after the next line break */
+    size_t begin = 0;
+    for (u32 t = 0; t < parse.n_threads; t++) {
+        size_t end = size * (t + 1) / parse.n_threads;
+        if (end < begin) {
+            end = begin;
+        } else if (end > 0 && end < size && file[end - 1] != '\n') {
+            const u8 *newline = memchr(file + end, '\n', size - end);
+            end = newline != NULL ? (size_t)(newline - file) + 1 : size;
+        }
+        parse.chunks[t].begin = begin;
+        parse.chunks[t].end = end;
+        begin = end;
+    }
+
+    pthread_barrier_init(&parse.barrier, NULL, parse.n_threads);
+    pthread_mutex_unlock(&gate);
+    nag_edge_list_worker(&args[0]);
+    nag_join_workers(threads, parse.n_threads);
+    pthread_barrier_destroy(&parse.barrier);
+
+    /* Close the gaps the skipped lines left between the chunks */
+    NAG_ParseErrors found = { 0 };
+    size_t n_edges = 0;
+    u64 max_node = 0;
+    for (u32 t = 0; t < parse.n_threads; t++) {
+        NAG_EdgeListChunk *chunk = &parse.chunks[t];
+        if (chunk->n_malformed != 0 && found.n_lines == 0) {
+            found.first_offset = chunk->first_malformed;
+        }
+        found.n_lines += chunk->n_malformed;
+        memmove(parse.from + n_edges, parse.from + chunk->base, sizeof(NAG_Idx) * chunk->n_edges);
+        memmove(parse.to + n_edges, parse.to + chunk->base, sizeof(NAG_Idx) * chunk->n_edges);
+        n_edges += chunk->n_edges;
+        max_node = NAG_MAX(max_node, chunk->max_node);
+    }
+    munmap((void *)file, size);
+    if (errors != NULL) {
+        *errors = found;
+    }
+
+    NAG_LoadStatus status = NAG_LOAD_OK;
+    if (found.n_lines != 0) {
+        status = NAG_LOAD_MALFORMED;
+    } else if (n_edges != (NAG_EdgeIdx)n_edges) {
+        status = NAG_LOAD_TOO_LARGE;
+    } else {
+        NAG_Idx n_nodes = n_edges == 0 ? 0 : (NAG_Idx)(max_node + 1);
+        *graph = nag_make_graph_from_edges(persist, scratch, n_nodes, parse.from, parse.to, (NAG_EdgeIdx)n_edges);
+    }
+    m_arena_tmp_release(tmp_arena);
+    return status;
+}
+
+NAG_Query nag_make_query(NAG_Graph *graph)
+{
+    return (NAG_Query){ .graph = graph, .epoch = 0, .persist_arena = graph->persist_arena,
+                        .scratch_arena = graph->scratch_arena,
+                        .visited = m_arena_alloc_zero(graph->persist_arena, sizeof(u32) * graph->n_nodes) };
+}
+
+NAG_Query nag_make_query_on(NAG_Graph *graph, Arena *persist, Arena *scratch)
+{
+    /* nag_query_shortest_path() would otherwise build and cache it on the first call */
+    if (graph->targets != NULL) {
+        nag_transpose(graph);
+    }
+    return (NAG_Query){ .graph = graph, .epoch = 0, .persist_arena = persist, .scratch_arena = scratch,
+                        .visited = m_arena_alloc_zero(persist, sizeof(u32) * graph->n_nodes) };
+}
+
+/* A query that lives on the scratch arena. Only valid until the scratch arena is cleared */
+static NAG_Query nag_scratch_query(NAG_Graph *graph)
+{
+    return (NAG_Query){ .graph = graph, .epoch = 1, .persist_arena = graph->persist_arena,
+                        .scratch_arena = graph->scratch_arena,
+                        .visited = m_arena_alloc_zero(graph->scratch_arena, sizeof(u32) * graph->n_nodes) };
+}
+
+/* Starts a new query. The visited stamps are only cleared when the epoch wraps around */
+static inline void nag_query_begin(NAG_Query *query)
+{
+    query->epoch++;
+    if (query->epoch == 0) {
+        memset(query->visited, 0, sizeof(u32) * query->graph->n_nodes);
+        query->epoch = 1;
+    }
+}
+
+static inline bool nag_is_visited(NAG_Query *query, NAG_Idx node)
+{
+    return query->visited[node] == query->epoch;
+}
+
+static inline void nag_set_visited(NAG_Query *query, NAG_Idx node)
+{
+    query->visited[node] = query->epoch;
+}
+
 static NAG_OrderList nag_traverse_all(NAG_Graph *graph, GraphTraverse traverse_func)
 {
-    u8 *visited = m_arena_alloc(graph->scratch_arena, sizeof(bool) * graph->n_nodes);
-    memset(visited, false, sizeof(NAG_Idx) * graph->n_nodes);
+    NAG_Query query = nag_scratch_query(graph);
 
     NAG_OrderList result = {0};
     u32 n_orders_allocated = 8;
     result.orders = malloc(sizeof(NAG_Order) * n_orders_allocated);
 
     for (NAG_Idx i = 0; i < graph->n_nodes; i++) {
-        if (visited[i]) {
+        if (nag_is_visited(&query, i)) {
             continue;
         }
-        NAG_Order order = traverse_func(graph, i, visited);
+        NAG_Order order = traverse_func(&query, i);
         result.orders[result.n++] = order;
         if (result.n == n_orders_allocated) {
             n_orders_allocated += 8;
@@ -83,41 +824,51 @@ static NAG_OrderList nag_traverse_all(NAG_Graph *graph, GraphTraverse traverse_f
     return result;
 }
 
-static inline bool linear_alloc_nodes(Arena *arena, u32 n)
+static inline bool linear_alloc_nodes(Arena *arena, size_t n)
 {
     void *r = m_arena_alloc_internal(arena, sizeof(NAG_Idx) * n, sizeof(NAG_Idx), false);
     return r != NULL;
 }
 
-static NAG_Order nag_dfs_internal(NAG_Graph *graph, NAG_Idx start_node, u8 *visited)
+static inline NAG_DfsFrame *alloc_frames(Arena *arena, size_t n)
 {
-    /* This will grow linearly on the persist arena as we add nodes to the order */
-    NAG_Idx *ordered = m_arena_alloc(graph->persist_arena, sizeof(NAG_Idx) * 1);
+    return m_arena_alloc_internal(arena, sizeof(NAG_DfsFrame) * n, _Alignof(NAG_DfsFrame), false);
+}
+
+/*
+ * Writes the order to ordered and returns its length. If grow_arena is given, ordered is the last
+ * allocation on it and grows linearly as we add nodes. Otherwise ordered must have room for every node.
+ */
+static NAG_Idx nag_dfs_fill(NAG_Query *query, NAG_Idx start_node, NAG_Idx *ordered, Arena *grow_arena)
+{
+    NAG_Graph *graph = query->graph;
     NAG_Idx ordered_len = 0;
 
     /* Everything we allocate on the scratch arena will be released before we returned */
-    ArenaTmp tmp_arena = m_arena_tmp_init(graph->scratch_arena);
-    NAG_Idx stack_size = NAG_STACK_GROW_SIZE;
-    NAG_Idx stack_top = 1;
+    ArenaTmp tmp_arena = m_arena_tmp_init(query->scratch_arena);
+    size_t stack_size = NAG_STACK_GROW_SIZE;
+    size_t stack_top = 1;
     /* Similar to ordered. Will grow linearly on the scratch arena as we add nodes to the stack */
-    NAG_Idx *stack = m_arena_alloc_internal(graph->scratch_arena, sizeof(NAG_Idx) * stack_size, sizeof(NAG_Idx), false);
+    NAG_Idx *stack = m_arena_alloc_internal(query->scratch_arena, sizeof(NAG_Idx) * stack_size, sizeof(NAG_Idx), false);
     stack[0] = start_node;
 
     while (stack_top != 0) {
         NAG_Idx current_node = stack[--stack_top];
-        if (visited[current_node]) {
+        if (nag_is_visited(query, current_node)) {
             continue;
         }
-        visited[current_node] = true;
+        nag_set_visited(query, current_node);
         ordered[ordered_len++] = current_node;
-        if (!linear_alloc_nodes(graph->persist_arena, 1)) {
+        if (grow_arena != NULL && !linear_alloc_nodes(grow_arena, 1)) {
             /* Persist arena is full. Report error. */
         }
 
-        for (NAG_GraphNode *n = graph->neighbor_list[current_node]; n != NULL; n = n->next) {
-            stack[stack_top++] = n->id;
+        NAG_NeighborIter it = nag_neighbors(graph, current_node);
+        NAG_Idx neighbor;
+        while (nag_next_neighbor(&it, &neighbor)) {
+            stack[stack_top++] = neighbor;
             if (stack_top == stack_size) {
-                if (!linear_alloc_nodes(graph->scratch_arena, NAG_STACK_GROW_SIZE)) {
+                if (!linear_alloc_nodes(query->scratch_arena, NAG_STACK_GROW_SIZE)) {
                     /* Scratch arena is full. Report error. */
                 }
                 stack_size += NAG_STACK_GROW_SIZE;
@@ -125,52 +876,71 @@ static NAG_Order nag_dfs_internal(NAG_Graph *graph, NAG_Idx start_node, u8 *visi
         }
     }
     m_arena_tmp_release(tmp_arena); // Reclaims the memory to the arena, not to the OS
+    return ordered_len;
+}
+
+static NAG_Order nag_dfs_internal(NAG_Query *query, NAG_Idx start_node)
+{
+    /* This will grow linearly on the persist arena as we add nodes to the order */
+    NAG_Idx *ordered = m_arena_alloc(query->persist_arena, sizeof(NAG_Idx) * 1);
+    NAG_Idx ordered_len = nag_dfs_fill(query, start_node, ordered, query->persist_arena);
     return (NAG_Order){ .n_nodes = ordered_len, .nodes = ordered };
 }
 
 NAG_Order nag_dfs_from(NAG_Graph *graph, NAG_Idx start_node)
 {
-    u8 *visited = m_arena_alloc(graph->scratch_arena, sizeof(bool) * graph->n_nodes);
-    memset(visited, false, sizeof(NAG_Idx) * graph->n_nodes);
-    NAG_Order dfs_order = nag_dfs_internal(graph, start_node, visited);
+    NAG_Query query = nag_scratch_query(graph);
+    NAG_Order dfs_order = nag_dfs_internal(&query, start_node);
     m_arena_clear(graph->scratch_arena);
     return dfs_order;
 }
 
+NAG_Order nag_query_dfs_from(NAG_Query *query, NAG_Idx start_node)
+{
+    nag_query_begin(query);
+    return nag_dfs_internal(query, start_node);
+}
+
 NAG_OrderList nag_dfs(NAG_Graph *graph)
 {
     return nag_traverse_all(graph, nag_dfs_internal);
 }
 
-static NAG_Order nag_bfs_internal(NAG_Graph *graph, NAG_Idx start_node, u8 *visited)
+/* Same contract as nag_dfs_fill() */
+static NAG_Idx nag_bfs_fill(NAG_Query *query, NAG_Idx start_node, NAG_Idx *ordered, Arena *grow_arena)
 {
-    /* This will grow linearly on the persist arena as we add nodes to the order */
-    NAG_Idx *ordered = m_arena_alloc(graph->persist_arena, sizeof(NAG_Idx) * 1);
+    NAG_Graph *graph = query->graph;
     NAG_Idx ordered_len = 0;
 
     /* Everything we allocate on the scratch arena will be released before we returned */
-    ArenaTmp tmp_arena = m_arena_tmp_init(graph->scratch_arena);
+    ArenaTmp tmp_arena = m_arena_tmp_init(query->scratch_arena);
 
-    NAG_Idx queue_size = NAG_QUEUE_GROW_SIZE;
-    NAG_Idx queue_low = 0;
-    NAG_Idx queue_high = 1;
+    size_t queue_size = NAG_QUEUE_GROW_SIZE;
+    size_t queue_low = 0;
+    size_t queue_high = 1;
     /* Similar to ordered. Will grow linearly on the scratch arena if we need to increase the size */
-    NAG_Idx *queue = m_arena_alloc_internal(graph->scratch_arena, sizeof(NAG_Idx) * NAG_QUEUE_GROW_SIZE, sizeof(NAG_Idx), false);
+    NAG_Idx *queue = m_arena_alloc_internal(query->scratch_arena, sizeof(NAG_Idx) * NAG_QUEUE_GROW_SIZE, sizeof(NAG_Idx), false);
     queue[0] = start_node;
 
     while (queue_low != queue_high) {
         NAG_Idx current_node = queue[queue_low++];
-        if (visited[current_node]) {
+        if (nag_is_visited(query, current_node)) {
             continue;
         }
-        visited[current_node] = true;
+        nag_set_visited(query, current_node);
         ordered[ordered_len++] = current_node;
-        if (!linear_alloc_nodes(graph->persist_arena, 1)) {
+        if (grow_arena != NULL && !linear_alloc_nodes(grow_arena, 1)) {
             /* Persist arena is full. Report error. */
         }
         
-        for (NAG_GraphNode *n = graph->neighbor_list[current_node]; n != NULL; n = n->next) {
-            queue[queue_high++] = n->id;
+        NAG_NeighborIter it = nag_neighbors(graph, current_node);
+        NAG_Idx neighbor;
+        while (nag_next_neighbor(&it, &neighbor)) {
+            /* Nodes already dequeued will be skipped anyway, so don't bother enqueuing them */
+            if (nag_is_visited(query, neighbor)) {
+                continue;
+            }
+            queue[queue_high++] = neighbor;
             /* 
              * Queue is full.
              * If we have a lot of unused space to the left, we shift the entire queue
@@ -179,12 +949,12 @@ static NAG_Order nag_bfs_internal(NAG_Graph *graph, NAG_Idx start_node, u8 *visi
             if (queue_high == queue_size) {
                 /* Shift left */
                 if (queue_low > queue_size / 2) {
-                    memmove(queue, queue + queue_low, queue_high - queue_low + 1);
+                    memmove(queue, queue + queue_low, sizeof(NAG_Idx) * (queue_high - queue_low));
                     queue_high -= queue_low;
                     queue_low = 0;
                 }
                 /* Increase the allocation for the queue */
-                if (!linear_alloc_nodes(graph->scratch_arena, NAG_QUEUE_GROW_SIZE)) {
+                if (!linear_alloc_nodes(query->scratch_arena, NAG_QUEUE_GROW_SIZE)) {
                     /* Scratch arena is full. Report error. */
                 }
                 queue_size += NAG_QUEUE_GROW_SIZE;
@@ -192,184 +962,2057 @@ static NAG_Order nag_bfs_internal(NAG_Graph *graph, NAG_Idx start_node, u8 *visi
         }
     }
     m_arena_tmp_release(tmp_arena); // Reclaims the memory to the arena, not to the OS
+    return ordered_len;
+}
+
+static NAG_Order nag_bfs_internal(NAG_Query *query, NAG_Idx start_node)
+{
+    /* This will grow linearly on the persist arena as we add nodes to the order */
+    NAG_Idx *ordered = m_arena_alloc(query->persist_arena, sizeof(NAG_Idx) * 1);
+    NAG_Idx ordered_len = nag_bfs_fill(query, start_node, ordered, query->persist_arena);
     return (NAG_Order){ .n_nodes = ordered_len, .nodes = ordered };
 }
 
 NAG_Order nag_bfs_from(NAG_Graph *graph, NAG_Idx start_node)
 {
-    u8 *visited = m_arena_alloc(graph->scratch_arena, sizeof(bool) * graph->n_nodes);
-    memset(visited, false, sizeof(NAG_Idx) * graph->n_nodes);
-    NAG_Order bfs_order = nag_bfs_internal(graph, start_node, visited);
+    NAG_Query query = nag_scratch_query(graph);
+    NAG_Order bfs_order = nag_bfs_internal(&query, start_node);
     m_arena_clear(graph->scratch_arena);
     return bfs_order;
 }
 
+NAG_Order nag_query_bfs_from(NAG_Query *query, NAG_Idx start_node)
+{
+    nag_query_begin(query);
+    return nag_bfs_internal(query, start_node);
+}
+
 NAG_OrderList nag_bfs(NAG_Graph *graph)
 {
     return nag_traverse_all(graph, nag_bfs_internal);
 }
 
-static NAG_Order nag_toposort_from_internal(NAG_Graph *graph, NAG_Idx start_node, u8 *visited)
+/* Every node ends up in exactly one order, so the nodes and the offsets fit in n_nodes up front */
+static NAG_FlatOrderList nag_make_flat_order_list(NAG_Graph *graph, Arena *arena)
 {
-    /* This will grow linearly on the persist arena as we add nodes to the order */
-    NAG_Idx *ordered = m_arena_alloc(graph->persist_arena, sizeof(NAG_Idx) * 1);
-    NAG_Idx ordered_len = 0;
+    assert(arena != graph->scratch_arena && "the scratch arena is cleared before returning");
+    NAG_FlatOrderList list = { .n = 0 };
+    list.offsets = m_arena_alloc(arena, sizeof(NAG_Idx) * ((size_t)graph->n_nodes + 1));
+    list.nodes = m_arena_alloc(arena, sizeof(NAG_Idx) * graph->n_nodes);
+    list.offsets[0] = 0;
+    return list;
+}
 
-    /* NOTE: Most of the code below here is just DFS + some backtracking */
+static NAG_FlatOrderList nag_traverse_all_flat(NAG_Graph *graph, Arena *arena, GraphFill fill_func)
+{
+    NAG_Query query = nag_scratch_query(graph);
+    NAG_FlatOrderList result = nag_make_flat_order_list(graph, arena);
+
+    NAG_Idx nodes_len = 0;
+    for (NAG_Idx i = 0; i < graph->n_nodes; i++) {
+        if (nag_is_visited(&query, i)) {
+            continue;
+        }
+        nodes_len += fill_func(&query, i, result.nodes + nodes_len, NULL);
+        result.offsets[++result.n] = nodes_len;
+    }
+
+    m_arena_clear(graph->scratch_arena);
+    return result;
+}
+
+NAG_FlatOrderList nag_dfs_flat(NAG_Graph *graph, Arena *arena)
+{
+    return nag_traverse_all_flat(graph, arena, nag_dfs_fill);
+}
+
+NAG_FlatOrderList nag_bfs_flat(NAG_Graph *graph, Arena *arena)
+{
+    return nag_traverse_all_flat(graph, arena, nag_bfs_fill);
+}
+
+NAG_Order nag_flat_order(NAG_FlatOrderList *list, NAG_Idx i)
+{
+    assert(i < list->n);
+    return (NAG_Order){ .n_nodes = list->offsets[i + 1] - list->offsets[i], .nodes = list->nodes + list->offsets[i] };
+}
+
+/*
+ * DFS that reports each node to the visitor when it is discovered and when all its neighbours are
+ * done. Does not start a new query epoch, so several calls can share the visited stamps.
+ */
+static bool nag_dfs_visit_internal(NAG_Query *query, NAG_Idx start_node, NAG_Visitor visitor, void *ctx)
+{
+    NAG_Graph *graph = query->graph;
 
     /* Everything we allocate on the scratch arena will be released before we returned */
-    ArenaTmp tmp_arena = m_arena_tmp_init(graph->scratch_arena);
-    NAG_Idx stack_size = NAG_STACK_GROW_SIZE;
-    NAG_Idx stack_top = 1;
-    /* Similar to ordered. Will grow linearly on the scratch arena as we add nodes to the stack */
-    NAG_Idx *stack = m_arena_alloc_internal(graph->scratch_arena, sizeof(NAG_Idx) * stack_size, sizeof(NAG_Idx), false);
-    stack[0] = start_node;
+    ArenaTmp tmp_arena = m_arena_tmp_init(query->scratch_arena);
+    size_t frames_size = NAG_STACK_GROW_SIZE;
+    size_t frames_top = 1;
+    /* Will grow linearly on the scratch arena as we descend */
+    NAG_DfsFrame *frames = alloc_frames(query->scratch_arena, frames_size);
+    frames[0] = (NAG_DfsFrame){ .node = start_node, .it = nag_neighbors(graph, start_node) };
+    nag_set_visited(query, start_node);
+    bool stopped = !visitor(start_node, NAG_VISIT_DISCOVER, ctx);
 
-    while (stack_top != 0) {
-        NAG_Idx current_node = stack[--stack_top];
-        if (visited[current_node]) {
-            ordered[ordered_len++] = current_node;
-            if (!linear_alloc_nodes(graph->persist_arena, 1)) {
-                /* Persist arena is full. Report error. */
+    while (!stopped && frames_top != 0) {
+        NAG_DfsFrame *frame = &frames[frames_top - 1];
+        NAG_Idx neighbor;
+        if (nag_next_neighbor(&frame->it, &neighbor)) {
+            if (nag_is_visited(query, neighbor)) {
+                continue;
+            }
+            nag_set_visited(query, neighbor);
+            if (frames_top == frames_size) {
+                if (!alloc_frames(query->scratch_arena, NAG_STACK_GROW_SIZE)) {
+                    /* Scratch arena is full. Report error. */
+                }
+                frames_size += NAG_STACK_GROW_SIZE;
             }
+            frames[frames_top++] = (NAG_DfsFrame){ .node = neighbor, .it = nag_neighbors(graph, neighbor) };
+            stopped = !visitor(neighbor, NAG_VISIT_DISCOVER, ctx);
             continue;
         }
 
-        visited[current_node] = true;
-        stack[stack_top++] = current_node; /* Next time we pop this node all neighbours have been visited */
-        if (stack_top == stack_size) {
-            if (!linear_alloc_nodes(graph->scratch_arena, NAG_STACK_GROW_SIZE)) {
-                /* Scratch arena is full. Report error. */
+        frames_top--;
+        stopped = !visitor(frame->node, NAG_VISIT_FINISH, ctx);
+    }
+    m_arena_tmp_release(tmp_arena); /* Reclaims the memory to the arena, not to the OS */
+    return stopped;
+}
+
+bool nag_dfs_visit(NAG_Query *query, NAG_Idx start_node, NAG_Visitor visitor, void *ctx)
+{
+    nag_query_begin(query);
+    return nag_dfs_visit_internal(query, start_node, visitor, ctx);
+}
+
+bool nag_bfs_visit(NAG_Query *query, NAG_Idx start_node, NAG_Visitor visitor, void *ctx)
+{
+    NAG_Graph *graph = query->graph;
+    nag_query_begin(query);
+
+    /* Everything we allocate on the scratch arena will be released before we returned */
+    ArenaTmp tmp_arena = m_arena_tmp_init(query->scratch_arena);
+    /*
+     * Nodes are only enqueued when discovered, so the queue never holds more than the nodes we reach.
+     * Will grow linearly on the scratch arena.
+     */
+    size_t queue_size = NAG_QUEUE_GROW_SIZE;
+    size_t queue_low = 0;
+    size_t queue_high = 1;
+    NAG_Idx *queue = m_arena_alloc_internal(query->scratch_arena, sizeof(NAG_Idx) * queue_size, sizeof(NAG_Idx), false);
+    queue[0] = start_node;
+    nag_set_visited(query, start_node);
+    bool stopped = !visitor(start_node, NAG_VISIT_DISCOVER, ctx);
+
+    while (!stopped && queue_low != queue_high) {
+        NAG_Idx current_node = queue[queue_low++];
+        NAG_NeighborIter it = nag_neighbors(graph, current_node);
+        NAG_Idx neighbor;
+        while (!stopped && nag_next_neighbor(&it, &neighbor)) {
+            if (nag_is_visited(query, neighbor)) {
+                continue;
+            }
+            nag_set_visited(query, neighbor);
+            queue[queue_high++] = neighbor;
+            if (queue_high == queue_size) {
+                if (!linear_alloc_nodes(query->scratch_arena, NAG_QUEUE_GROW_SIZE)) {
+                    /* Scratch arena is full. Report error. */
+                }
+                queue_size += NAG_QUEUE_GROW_SIZE;
             }
-            stack_size += NAG_STACK_GROW_SIZE;
+            stopped = !visitor(neighbor, NAG_VISIT_DISCOVER, ctx);
         }
+        if (!stopped) {
+            stopped = !visitor(current_node, NAG_VISIT_FINISH, ctx);
+        }
+    }
+    m_arena_tmp_release(tmp_arena); /* Reclaims the memory to the arena, not to the OS */
+    return stopped;
+}
 
-        for (NAG_GraphNode *n = graph->neighbor_list[current_node]; n != NULL; n = n->next) {
-            stack[stack_top++] = n->id;
-            if (stack_top == stack_size) {
-                if (!linear_alloc_nodes(graph->scratch_arena, NAG_STACK_GROW_SIZE)) {
-                    /* Scratch arena is full. Report error. */
+static bool nag_stop_at_target(NAG_Idx node, NAG_VisitEvent event, void *ctx)
+{
+    return !(event == NAG_VISIT_DISCOVER && node == *(NAG_Idx *)ctx);
+}
+
+bool nag_query_dfs_from_to(NAG_Query *query, NAG_Idx start_node, NAG_Idx target_node)
+{
+    return nag_dfs_visit(query, start_node, nag_stop_at_target, &target_node);
+}
+
+bool nag_query_bfs_from_to(NAG_Query *query, NAG_Idx start_node, NAG_Idx target_node)
+{
+    return nag_bfs_visit(query, start_node, nag_stop_at_target, &target_node);
+}
+
+bool nag_dfs_from_to(NAG_Graph *graph, NAG_Idx start_node, NAG_Idx target_node)
+{
+    NAG_Query query = nag_scratch_query(graph);
+    bool found = nag_query_dfs_from_to(&query, start_node, target_node);
+    m_arena_clear(graph->scratch_arena);
+    return found;
+}
+
+bool nag_bfs_from_to(NAG_Graph *graph, NAG_Idx start_node, NAG_Idx target_node)
+{
+    NAG_Query query = nag_scratch_query(graph);
+    bool found = nag_query_bfs_from_to(&query, start_node, target_node);
+    m_arena_clear(graph->scratch_arena);
+    return found;
+}
+
+NAG_Order nag_query_shortest_path(NAG_Query *query, NAG_Idx start_node, NAG_Idx target_node)
+{
+    NAG_Graph *graph = query->graph;
+    NAG_Graph reversed = nag_transpose(graph);
+
+    /*
+     * Each direction stamps the nodes it reaches with its own epoch, so a node stamped by the other
+     * direction is where the searches meet. Make sure the two epochs do not straddle a wraparound.
+     */
+    nag_query_begin(query);
+    if (query->epoch == U32_MAX) {
+        nag_query_begin(query);
+    }
+    u32 marks[2] = { query->epoch, query->epoch + 1 };
+    query->epoch++;
+
+    /* Everything we allocate on the scratch arena will be released before we returned */
+    ArenaTmp tmp_arena = m_arena_tmp_init(query->scratch_arena);
+    /*
+     * parent[node] is the previous node on the path towards start_node for nodes reached forward,
+     * and the next node on the path towards target_node for nodes reached backward.
+     * Only entries of stamped nodes are ever read, so nothing needs to be cleared.
+     */
+    NAG_Idx *parent = m_arena_alloc(query->scratch_arena, sizeof(NAG_Idx) * graph->n_nodes);
+    /* Each node is enqueued at most once in one direction, so the queues never outgrow n_nodes */
+    NAG_Idx *queues[2] = {
+        m_arena_alloc(query->scratch_arena, sizeof(NAG_Idx) * graph->n_nodes),
+        m_arena_alloc(query->scratch_arena, sizeof(NAG_Idx) * graph->n_nodes),
+    };
+    NAG_Graph *directions[2] = { graph, &reversed };
+    size_t queue_low[2] = { 0, 0 };
+    size_t queue_high[2] = { 1, 1 };
+    queues[0][0] = start_node;
+    queues[1][0] = target_node;
+    query->visited[start_node] = marks[0];
+    query->visited[target_node] = marks[1];
+
+    /* The last edge crossed, going from the forward side to the backward side */
+    NAG_Idx meet_from = start_node;
+    NAG_Idx meet_to = target_node;
+    bool found = start_node == target_node;
+
+    while (!found && queue_low[0] != queue_high[0] && queue_low[1] != queue_high[1]) {
+        /* Expand one full level on the side with the smaller frontier */
+        int side = (queue_high[0] - queue_low[0]) <= (queue_high[1] - queue_low[1]) ? 0 : 1;
+        NAG_Idx *queue = queues[side];
+        size_t level_end = queue_high[side];
+
+        while (!found && queue_low[side] != level_end) {
+            NAG_Idx current_node = queue[queue_low[side]++];
+            NAG_NeighborIter it = nag_neighbors(directions[side], current_node);
+            NAG_Idx neighbor;
+            while (nag_next_neighbor(&it, &neighbor)) {
+                u32 stamp = query->visited[neighbor];
+                if (stamp == marks[side]) {
+                    continue;
                 }
-                stack_size += NAG_STACK_GROW_SIZE;
+                if (stamp == marks[1 - side]) {
+                    meet_from = side == 0 ? current_node : neighbor;
+                    meet_to = side == 0 ? neighbor : current_node;
+                    found = true;
+                    break;
+                }
+                query->visited[neighbor] = marks[side];
+                parent[neighbor] = current_node;
+                queue[queue_high[side]++] = neighbor;
+            }
+        }
+    }
+
+    NAG_Order path = { 0 };
+    if (found) {
+        /* Walk from the meeting edge out to both ends, then fill the path in from both directions */
+        size_t forward_len = 1;
+        for (NAG_Idx n = meet_from; n != start_node; n = parent[n]) {
+            forward_len++;
+        }
+        size_t backward_len = 0;
+        if (start_node != target_node) {
+            backward_len = 1;
+            for (NAG_Idx n = meet_to; n != target_node; n = parent[n]) {
+                backward_len++;
             }
         }
+
+        path.n_nodes = forward_len + backward_len;
+        path.nodes = m_arena_alloc(query->persist_arena, sizeof(NAG_Idx) * path.n_nodes);
+        NAG_Idx n = meet_from;
+        for (size_t i = forward_len; i > 0; i--) {
+            path.nodes[i - 1] = n;
+            n = parent[n];
+        }
+        n = meet_to;
+        for (size_t i = 0; i < backward_len; i++) {
+            path.nodes[forward_len + i] = n;
+            n = parent[n];
+        }
     }
+
     m_arena_tmp_release(tmp_arena); /* Reclaims the memory to the arena, not to the OS */
-    return (NAG_Order){ .n_nodes = ordered_len, .nodes = ordered };
+    return path;
 }
 
-NAG_Order nag_rev_toposort(NAG_Graph *graph)
+NAG_Order nag_shortest_path(NAG_Graph *graph, NAG_Idx start_node, NAG_Idx target_node)
 {
-    NAG_OrderList all = nag_traverse_all(graph, nag_toposort_from_internal);
-    bool *included = m_arena_alloc(graph->scratch_arena, sizeof(NAG_Idx) * graph->n_nodes);
-    memset(included, 0, sizeof(NAG_Idx) * graph->n_nodes);
+    NAG_Query query = nag_scratch_query(graph);
+    NAG_Order path = nag_query_shortest_path(&query, start_node, target_node);
+    m_arena_clear(graph->scratch_arena);
+    return path;
+}
 
-    NAG_Order final;
-    final.n_nodes = 0;
-    final.nodes = m_arena_alloc(graph->persist_arena, sizeof(NAG_Idx) * graph->n_nodes);
+bool nag_query_add_edge_checked(NAG_Query *query, NAG_Idx from, NAG_Idx to, NAG_Order *cycle)
+{
+    NAG_Graph *graph = query->graph;
+    *cycle = (NAG_Order){ 0 };
+    nag_query_begin(query);
 
-    for (u32 i = 0; i < all.n; i++) {
-        NAG_Order current = all.orders[i];
-        for (u32 j = 0; j < current.n_nodes; j++) {
-            NAG_Idx current_idx = current.nodes[j];
-            if (!included[current_idx]) {
-                included[current_idx] = true;
-                final.nodes[final.n_nodes++] = current_idx;
+    /* Everything we allocate on the scratch arena will be released before we returned */
+    ArenaTmp tmp_arena = m_arena_tmp_init(query->scratch_arena);
+    /* Only entries of visited nodes are ever read, so nothing needs to be cleared */
+    NAG_Idx *parent = m_arena_alloc(query->scratch_arena, sizeof(NAG_Idx) * graph->n_nodes);
+    NAG_Idx *queue = m_arena_alloc(query->scratch_arena, sizeof(NAG_Idx) * graph->n_nodes);
+    size_t queue_low = 0;
+    size_t queue_high = 1;
+    queue[0] = to;
+    nag_set_visited(query, to);
+
+    /* BFS from to. The edge closes a cycle if and only if from is reachable */
+    bool found = from == to;
+    while (!found && queue_low != queue_high) {
+        NAG_Idx current_node = queue[queue_low++];
+        NAG_NeighborIter it = nag_neighbors(graph, current_node);
+        NAG_Idx neighbor;
+        while (nag_next_neighbor(&it, &neighbor)) {
+            if (nag_is_visited(query, neighbor)) {
+                continue;
+            }
+            nag_set_visited(query, neighbor);
+            parent[neighbor] = current_node;
+            if (neighbor == from) {
+                found = true;
+                break;
             }
+            queue[queue_high++] = neighbor;
         }
     }
 
-    return final;
+    if (found) {
+        /* Walking the parents from from back to to gives the cycle in reverse, minus from at the front */
+        cycle->n_nodes = 1;
+        if (from != to) {
+            for (NAG_Idx n = parent[from]; n != to; n = parent[n]) {
+                cycle->n_nodes++;
+            }
+            cycle->n_nodes++;
+        }
+        cycle->nodes = m_arena_alloc(query->persist_arena, sizeof(NAG_Idx) * cycle->n_nodes);
+        cycle->nodes[0] = from;
+        NAG_Idx n = from;
+        for (NAG_Idx i = cycle->n_nodes - 1; i > 0; i--) {
+            n = parent[n];
+            cycle->nodes[i] = n;
+        }
+    }
+
+    m_arena_tmp_release(tmp_arena); /* Reclaims the memory to the arena, not to the OS */
+    if (!found) {
+        nag_add_edge(graph, from, to);
+    }
+    return !found;
 }
 
-static inline bool node_on_stack(NAG_Idx *stack, u32 stack_top, NAG_Idx node)
+bool nag_add_edge_checked(NAG_Graph *graph, NAG_Idx from, NAG_Idx to, NAG_Order *cycle)
 {
-    for (u32 i = stack_top; i > 0; i--) {
-        if (stack[i] == node) {
-            return true;
+    NAG_Query query = nag_scratch_query(graph);
+    bool added = nag_query_add_edge_checked(&query, from, to, cycle);
+    m_arena_clear(graph->scratch_arena);
+    return added;
+}
+
+#define NAG_BITMAP_WORDS(n_bits) (((size_t)(n_bits) + 63) / 64)
+#define NAG_BITMAP_GET(bitmap, i) (((bitmap)[(i) / 64] >> ((i) % 64)) & 1)
+#define NAG_BITMAP_SET(bitmap, i) ((bitmap)[(i) / 64] |= (u64)1 << ((i) % 64))
+
+NAG_BfsLevels nag_bfs_levels(NAG_Graph *graph, NAG_Idx start_node)
+{
+    NAG_Graph reversed = nag_transpose(graph);
+
+    NAG_BfsLevels result;
+    /* The order doubles as the queue. Each level is a contiguous slice of it */
+    result.order.nodes = m_arena_alloc(graph->persist_arena, sizeof(NAG_Idx) * graph->n_nodes);
+    result.depth = m_arena_alloc(graph->persist_arena, sizeof(NAG_Idx) * graph->n_nodes);
+    memset(result.depth, 0xff, sizeof(NAG_Idx) * graph->n_nodes); /* NAG_UNDISCOVERED has all bits set */
+
+    NAG_Idx *order = result.order.nodes;
+    NAG_Idx *depth = result.depth;
+    size_t order_len = 1;
+    order[0] = start_node;
+    depth[start_node] = 0;
+
+    /* Everything we allocate on the scratch arena will be released before we returned */
+    ArenaTmp tmp_arena = m_arena_tmp_init(graph->scratch_arena);
+    size_t n_words = NAG_BITMAP_WORDS(graph->n_nodes);
+    u64 *frontier = m_arena_alloc(graph->scratch_arena, sizeof(u64) * n_words);
+
+    /* Edges out of the frontier and edges out of nodes not yet reached, used to pick the direction */
+    NAG_EdgeIdx frontier_edges = graph->offsets[start_node + 1] - graph->offsets[start_node];
+    NAG_EdgeIdx unexplored_edges = graph->n_edges - frontier_edges;
+    bool bottom_up = false;
+
+    size_t level_start = 0;
+    NAG_Idx level = 0;
+    while (level_start != order_len) {
+        size_t level_end = order_len;
+        size_t frontier_len = level_end - level_start;
+
+        /*
+         * Heuristic from Beamer et al. Go bottom-up when the frontier has many more edges to check
+         * than the unreached part of the graph, and back to top-down once the frontier is small again.
+         */
+        if (!bottom_up && frontier_edges > unexplored_edges / NAG_BFS_ALPHA) {
+            bottom_up = true;
+        } else if (bottom_up && frontier_len < graph->n_nodes / NAG_BFS_BETA) {
+            bottom_up = false;
+        }
+
+        frontier_edges = 0;
+        if (bottom_up) {
+            /* Every unreached node looks for a parent in the frontier and stops at the first one */
+            memset(frontier, 0, sizeof(u64) * n_words);
+            for (size_t i = level_start; i < level_end; i++) {
+                NAG_BITMAP_SET(frontier, order[i]);
+            }
+            for (NAG_Idx node = 0; node < graph->n_nodes; node++) {
+                if (depth[node] != NAG_UNDISCOVERED) {
+                    continue;
+                }
+                for (NAG_EdgeIdx e = reversed.offsets[node]; e < reversed.offsets[node + 1]; e++) {
+                    if (NAG_BITMAP_GET(frontier, reversed.targets[e])) {
+                        depth[node] = level + 1;
+                        order[order_len++] = node;
+                        frontier_edges += graph->offsets[node + 1] - graph->offsets[node];
+                        break;
+                    }
+                }
+            }
+        } else {
+            for (size_t i = level_start; i < level_end; i++) {
+                NAG_Idx node = order[i];
+                for (NAG_EdgeIdx e = graph->offsets[node]; e < graph->offsets[node + 1]; e++) {
+                    NAG_Idx neighbor = graph->targets[e];
+                    if (depth[neighbor] == NAG_UNDISCOVERED) {
+                        depth[neighbor] = level + 1;
+                        order[order_len++] = neighbor;
+                        frontier_edges += graph->offsets[neighbor + 1] - graph->offsets[neighbor];
+                    }
+                }
+            }
         }
+        unexplored_edges -= frontier_edges;
+        level_start = level_end;
+        level++;
     }
-    return false;
+
+    m_arena_tmp_release(tmp_arena); /* Reclaims the memory to the arena, not to the OS */
+    result.order.n_nodes = order_len;
+    return result;
 }
 
+/* Per-thread state. The next frontier found by a worker grows linearly on its own arena */
 typedef struct {
-    NAG_Idx *stack;
-    bool *on_stack;
-    NAG_Idx *low_link;
-    NAG_Idx *discovery_time;
-    NAG_Idx time;
-    NAG_Idx stack_top;
-    Arena *scratch_arena;
-} NAG_TarjanContext;
+    Arena arena;
+    NAG_Idx *next;
+    size_t next_len;
+    size_t copy_offset; // where the next frontier goes in the shared order
+} NAG_BfsWorker;
 
-static void nag_tarjan_scc_dfs(NAG_Graph *graph, NAG_Idx node, NAG_TarjanContext *ctx, NAG_OrderList *sccs) {
-    ctx->discovery_time[node] = ctx->time;
-    ctx->low_link[node] = ctx->time;
-    ctx->time++;
-    ctx->stack[ctx->stack_top++] = node;
-    ctx->on_stack[node] = true;
+typedef struct {
+    NAG_Graph *graph;
+    NAG_Idx *order;
+    NAG_Idx *depth;
+    _Atomic u64 *visited; // bitmap, claimed with atomic test-and-set
+    /* The frontier is order[level_start] .. order[level_end - 1]. Only written by worker 0 */
+    size_t level_start;
+    size_t level_end;
+    NAG_Idx level;
+    bool done;
+    atomic_size_t next_chunk;
+    pthread_barrier_t barrier;
+    u32 n_threads;
+    NAG_BfsWorker *workers;
+} NAG_ParallelBfs;
+
+typedef struct {
+    NAG_ParallelBfs *bfs;
+    u32 id;
+} NAG_BfsWorkerArg;
+
+static void *nag_bfs_worker(void *arg)
+{
+    NAG_ParallelBfs *bfs = ((NAG_BfsWorkerArg *)arg)->bfs;
+    u32 id = ((NAG_BfsWorkerArg *)arg)->id;
+    NAG_BfsWorker *self = &bfs->workers[id];
+    NAG_Graph *graph = bfs->graph;
 
-    for (NAG_GraphNode *neighbor = graph->neighbor_list[node]; neighbor != NULL; neighbor = neighbor->next) {
-        NAG_Idx neighbor_id = neighbor->id;
-        if (ctx->discovery_time[neighbor_id] == NAG_UNDISCOVERED) {
-            /* If neighbor is not yet visited, recurse on it */
-            nag_tarjan_scc_dfs(graph, neighbor_id, ctx, sccs);
-            ctx->low_link[node] = NAG_MIN(ctx->low_link[node], ctx->low_link[neighbor_id]);
-        } else if (ctx->on_stack[neighbor_id]) {
-            /* Update low-link value if the neighbor is on the stack */
-            ctx->low_link[node] = NAG_MIN(ctx->low_link[node], ctx->discovery_time[neighbor_id]);
+    while (1) {
+        /* Expand: claim chunks of the frontier until it is exhausted */
+        size_t frontier_len = bfs->level_end - bfs->level_start;
+        size_t chunk;
+        while ((chunk = atomic_fetch_add_explicit(&bfs->next_chunk, NAG_PARALLEL_CHUNK_SIZE, memory_order_relaxed))
+               < frontier_len) {
+            size_t chunk_end = NAG_MIN(chunk + NAG_PARALLEL_CHUNK_SIZE, frontier_len);
+            for (size_t i = bfs->level_start + chunk; i < bfs->level_start + chunk_end; i++) {
+                NAG_Idx node = bfs->order[i];
+                for (NAG_EdgeIdx e = graph->offsets[node]; e < graph->offsets[node + 1]; e++) {
+                    NAG_Idx neighbor = graph->targets[e];
+                    _Atomic u64 *word = &bfs->visited[neighbor / 64];
+                    u64 bit = (u64)1 << (neighbor % 64);
+                    /* Plain load first so already visited nodes don't cost an atomic read-modify-write */
+                    if (atomic_load_explicit(word, memory_order_relaxed) & bit) {
+                        continue;
+                    }
+                    if (atomic_fetch_or_explicit(word, bit, memory_order_relaxed) & bit) {
+                        continue;
+                    }
+                    bfs->depth[neighbor] = bfs->level + 1;
+                    self->next[self->next_len++] = neighbor;
+                    /* Can not fail, the arena has room for every node. Not inside the assert, it must run */
+                    bool grown = linear_alloc_nodes(&self->arena, 1);
+                    assert(grown && "worker arena is sized for every node");
+                    (void)grown;
+                }
+            }
+        }
+        pthread_barrier_wait(&bfs->barrier);
+
+        /* Merge: worker 0 hands out where each next frontier goes, then everyone copies their own */
+        if (id == 0) {
+            size_t offset = bfs->level_end;
+            for (u32 t = 0; t < bfs->n_threads; t++) {
+                bfs->workers[t].copy_offset = offset;
+                offset += bfs->workers[t].next_len;
+            }
+            bfs->done = offset == bfs->level_end;
+            bfs->level_start = bfs->level_end;
+            bfs->level_end = offset;
+            bfs->level++;
+            atomic_store_explicit(&bfs->next_chunk, 0, memory_order_relaxed);
+        }
+        pthread_barrier_wait(&bfs->barrier);
+        memcpy(bfs->order + self->copy_offset, self->next, sizeof(NAG_Idx) * self->next_len);
+        self->next_len = 0;
+        m_arena_clear(&self->arena);
+        self->next = m_arena_alloc_internal(&self->arena, sizeof(NAG_Idx) * 1, sizeof(NAG_Idx), false);
+        pthread_barrier_wait(&bfs->barrier);
+
+        if (bfs->done) {
+            return NULL;
         }
     }
+}
+
+NAG_BfsLevels nag_bfs_parallel(NAG_Graph *graph, NAG_Idx start_node, u32 n_threads)
+{
+    assert(graph->targets != NULL && "graph must be frozen");
+    if (n_threads == 0) {
+        n_threads = 1;
+    }
 
-    /* If node is a root node, pop the stack and form an SCC */
-    if (ctx->low_link[node] == ctx->discovery_time[node]) {
-        NAG_Order scc = {0};
-        /* This will grow linearly on the persist arena as we add nodes to the order */
-        scc.nodes = m_arena_alloc(graph->persist_arena, sizeof(NAG_Idx) * 1);
+    NAG_BfsLevels result;
+    result.order.nodes = m_arena_alloc(graph->persist_arena, sizeof(NAG_Idx) * graph->n_nodes);
+    result.depth = m_arena_alloc(graph->persist_arena, sizeof(NAG_Idx) * graph->n_nodes);
+    memset(result.depth, 0xff, sizeof(NAG_Idx) * graph->n_nodes); /* NAG_UNDISCOVERED has all bits set */
 
-        while (1) {
-            NAG_Idx top = ctx->stack[--ctx->stack_top];
-            ctx->on_stack[top] = false;
-            scc.nodes[scc.n_nodes++] = top;
-            if (!linear_alloc_nodes(graph->persist_arena, 1)) {
-                /* Persist arena is full. Report error. */
-            }
-            if (top == node) break;
+    NAG_ParallelBfs bfs = {
+        .graph = graph, .order = result.order.nodes, .depth = result.depth,
+        .level_start = 0, .level_end = 1, .level = 0, .done = false, .n_threads = n_threads,
+    };
+    atomic_init(&bfs.next_chunk, 0);
+    bfs.visited = m_arena_alloc_zero(graph->scratch_arena, sizeof(u64) * NAG_BITMAP_WORDS(graph->n_nodes));
+    bfs.workers = m_arena_alloc(graph->scratch_arena, sizeof(NAG_BfsWorker) * n_threads);
+    NAG_BfsWorkerArg *args = m_arena_alloc(graph->scratch_arena, sizeof(NAG_BfsWorkerArg) * n_threads);
+    NAG_WorkerThread *threads = m_arena_alloc(graph->scratch_arena, sizeof(NAG_WorkerThread) * n_threads);
+
+    bfs.order[0] = start_node;
+    bfs.depth[start_node] = 0;
+    bfs.visited[start_node / 64] = (u64)1 << (start_node % 64);
+
+    /* A worker can at most find every node in one level */
+    for (u32 t = 0; t < n_threads; t++) {
+        NAG_BfsWorker *worker = &bfs.workers[t];
+        nag_thread_arena_init(&worker->arena, sizeof(NAG_Idx) * ((size_t)graph->n_nodes + 1));
+        worker->next = m_arena_alloc_internal(&worker->arena, sizeof(NAG_Idx) * 1, sizeof(NAG_Idx), false);
+        worker->next_len = 0;
+        args[t] = (NAG_BfsWorkerArg){ .bfs = &bfs, .id = t };
+    }
+
+    /* The calling thread is worker 0. Workers that could not be started simply never get a chunk */
+    pthread_mutex_t gate = PTHREAD_MUTEX_INITIALIZER;
+    pthread_mutex_lock(&gate);
+    bfs.n_threads = nag_start_workers(&gate, threads, n_threads, nag_bfs_worker, args, sizeof(NAG_BfsWorkerArg));
+    pthread_barrier_init(&bfs.barrier, NULL, bfs.n_threads);
+    pthread_mutex_unlock(&gate);
+    nag_bfs_worker(&args[0]);
+    nag_join_workers(threads, bfs.n_threads);
+    pthread_barrier_destroy(&bfs.barrier);
+
+    for (u32 t = 0; t < n_threads; t++) {
+        m_arena_release(&bfs.workers[t].arena);
+    }
+    m_arena_clear(graph->scratch_arena);
+    result.order.n_nodes = bfs.level_end;
+    return result;
+}
+
+/* Appends nodes to an order that grows linearly on the persist arena */
+typedef struct {
+    Arena *arena;
+    NAG_Order order;
+} NAG_OrderBuilder;
+
+static bool nag_append_on_finish(NAG_Idx node, NAG_VisitEvent event, void *ctx)
+{
+    if (event == NAG_VISIT_FINISH) {
+        NAG_OrderBuilder *builder = ctx;
+        builder->order.nodes[builder->order.n_nodes++] = node;
+        if (!linear_alloc_nodes(builder->arena, 1)) {
+            /* Persist arena is full. Report error. */
+        }
+    }
+    return true;
+}
+
+static NAG_Order nag_toposort_from_internal(NAG_Query *query, NAG_Idx start_node)
+{
+    /* NOTE: This is just DFS where a node is added to the order once all its neighbours are done */
+    NAG_OrderBuilder builder = { .arena = query->graph->persist_arena };
+    /* This will grow linearly on the persist arena as we add nodes to the order */
+    builder.order.nodes = m_arena_alloc(builder.arena, sizeof(NAG_Idx) * 1);
+    nag_dfs_visit_internal(query, start_node, nag_append_on_finish, &builder);
+    return builder.order;
+}
+
+NAG_Order nag_rev_toposort(NAG_Graph *graph)
+{
+    /* Every node is in exactly one of the orders, so they can just be concatenated */
+    NAG_OrderList all = nag_traverse_all(graph, nag_toposort_from_internal);
+
+    NAG_Order final;
+    final.n_nodes = 0;
+    final.nodes = m_arena_alloc(graph->persist_arena, sizeof(NAG_Idx) * graph->n_nodes);
+
+    for (u32 i = 0; i < all.n; i++) {
+        NAG_Order current = all.orders[i];
+        memcpy(final.nodes + final.n_nodes, current.nodes, sizeof(NAG_Idx) * current.n_nodes);
+        final.n_nodes += current.n_nodes;
+    }
+
+    free(all.orders);
+    return final;
+}
+
+/* Fills levels->order.nodes and levels->level_offsets, which must have room for every node */
+static void nag_topo_levels_internal(NAG_Graph *graph, NAG_TopoLevels *levels)
+{
+    NAG_Graph reversed = nag_transpose(graph);
+    levels->n_levels = 0;
+    levels->max_width = 0;
+
+    /* The number of neighbors of each node that have not been placed in a level yet */
+    NAG_EdgeIdx *remaining = m_arena_alloc(graph->scratch_arena, sizeof(NAG_EdgeIdx) * graph->n_nodes);
+    /* The order doubles as the queue */
+    NAG_Idx *order = levels->order.nodes;
+    NAG_Idx order_len = 0;
+    for (NAG_Idx node = 0; node < graph->n_nodes; node++) {
+        remaining[node] = graph->offsets[node + 1] - graph->offsets[node];
+        if (remaining[node] == 0) {
+            order[order_len++] = node;
         }
+    }
 
-        /* This implemention does not care about trivial scc's */
-        if (scc.n_nodes != 1) {
-            if (sccs->n == 0 || sccs->n % 8 == 0) { // TODO: this is hacky
-                sccs->orders = realloc(sccs->orders, sizeof(NAG_Order) * (sccs->n + 8));
+    NAG_Idx level_start = 0;
+    while (level_start != order_len) {
+        NAG_Idx level_end = order_len;
+        levels->level_offsets[levels->n_levels++] = level_start;
+        levels->max_width = NAG_MAX(levels->max_width, level_end - level_start);
+        for (NAG_Idx i = level_start; i < level_end; i++) {
+            for (NAG_EdgeIdx e = reversed.offsets[order[i]]; e < reversed.offsets[order[i] + 1]; e++) {
+                NAG_Idx dependent = reversed.targets[e];
+                if (--remaining[dependent] == 0) {
+                    order[order_len++] = dependent;
+                }
             }
-            sccs->orders[sccs->n++] = scc;
         }
+        level_start = level_end;
     }
+    levels->level_offsets[levels->n_levels] = order_len;
+    levels->order.n_nodes = order_len;
 }
 
-NAG_OrderList nag_scc(NAG_Graph *graph) {
-    NAG_OrderList sccs;
-    sccs.n = 0;
-    sccs.orders = malloc(sizeof(NAG_Order) * sccs.n);
+NAG_TopoLevels nag_topo_levels(NAG_Graph *graph)
+{
+    NAG_TopoLevels levels;
+    levels.order.nodes = m_arena_alloc(graph->persist_arena, sizeof(NAG_Idx) * graph->n_nodes);
+    /* There can be at most one level per node */
+    levels.level_offsets = m_arena_alloc(graph->persist_arena, sizeof(NAG_Idx) * ((size_t)graph->n_nodes + 1));
+    nag_topo_levels_internal(graph, &levels);
 
-    NAG_TarjanContext ctx;
-    ctx.stack = m_arena_alloc(graph->scratch_arena, sizeof(NAG_Idx) * graph->n_nodes);
-    ctx.on_stack = m_arena_alloc(graph->scratch_arena, sizeof(bool) * graph->n_nodes);
-    ctx.low_link = m_arena_alloc(graph->scratch_arena, sizeof(NAG_Idx) * graph->n_nodes);
-    ctx.discovery_time = m_arena_alloc(graph->scratch_arena, sizeof(NAG_Idx) * graph->n_nodes);
-    ctx.time = 0;
-    ctx.stack_top = 0;
-    ctx.scratch_arena = graph->scratch_arena;
+    m_arena_clear(graph->scratch_arena);
+    return levels;
+}
 
-    memset(ctx.on_stack, false, sizeof(bool) * graph->n_nodes);
-    memset(ctx.discovery_time, NAG_UNDISCOVERED, sizeof(NAG_Idx) * graph->n_nodes);
+static inline NAG_Weight nag_node_weight(NAG_Graph *graph, NAG_Idx node)
+{
+    return graph->node_weights != NULL ? graph->node_weights[node] : 1;
+}
 
-    for (NAG_Idx i = 0; i < graph->n_nodes; i++) {
-        if (ctx.discovery_time[i] == NAG_UNDISCOVERED) {
-            nag_tarjan_scc_dfs(graph, i, &ctx, &sccs);
+static inline NAG_Weight nag_edge_weight(NAG_Graph *graph, NAG_EdgeIdx edge)
+{
+    return graph->edge_weights != NULL ? graph->edge_weights[edge] : 0;
+}
+
+NAG_CriticalPath nag_critical_path(NAG_Graph *graph)
+{
+    NAG_CriticalPath result = { 0 };
+    result.earliest_start = m_arena_alloc_zero(graph->persist_arena, sizeof(NAG_Weight) * graph->n_nodes);
+    result.slack = m_arena_alloc_zero(graph->persist_arena, sizeof(NAG_Weight) * graph->n_nodes);
+
+    NAG_TopoLevels levels;
+    levels.order.nodes = m_arena_alloc(graph->scratch_arena, sizeof(NAG_Idx) * graph->n_nodes);
+    levels.level_offsets = m_arena_alloc(graph->scratch_arena, sizeof(NAG_Idx) * ((size_t)graph->n_nodes + 1));
+    nag_topo_levels_internal(graph, &levels);
+    NAG_Idx *order = levels.order.nodes;
+    NAG_Weight *start = result.earliest_start;
+
+    /* Leaf-first, so every neighbor has its start set before the nodes depending on it */
+    NAG_Idx last = NAG_UNDISCOVERED; // the node that finishes last
+    for (NAG_Idx i = 0; i < levels.order.n_nodes; i++) {
+        NAG_Idx node = order[i];
+        for (NAG_EdgeIdx e = graph->offsets[node]; e < graph->offsets[node + 1]; e++) {
+            NAG_Idx neighbor = graph->targets[e];
+            start[node] = NAG_MAX(start[node], start[neighbor] + nag_node_weight(graph, neighbor)
+                                                   + nag_edge_weight(graph, e));
+        }
+        NAG_Weight finish = start[node] + nag_node_weight(graph, node);
+        if (last == NAG_UNDISCOVERED || finish > result.length) {
+            result.length = finish;
+            last = node;
         }
     }
 
+    /* Backwards, so latest_finish of a node is final once every node depending on it is handled */
+    NAG_Weight *latest_finish = m_arena_alloc(graph->scratch_arena, sizeof(NAG_Weight) * graph->n_nodes);
+    for (NAG_Idx node = 0; node < graph->n_nodes; node++) {
+        latest_finish[node] = result.length;
+    }
+    for (NAG_Idx i = levels.order.n_nodes; i-- > 0;) {
+        NAG_Idx node = order[i];
+        NAG_Weight latest_start = latest_finish[node] - nag_node_weight(graph, node);
+        result.slack[node] = latest_start - start[node];
+        for (NAG_EdgeIdx e = graph->offsets[node]; e < graph->offsets[node + 1]; e++) {
+            NAG_Idx neighbor = graph->targets[e];
+            latest_finish[neighbor] = NAG_MIN(latest_finish[neighbor], latest_start - nag_edge_weight(graph, e));
+        }
+    }
+
+    /*
+     * Walk down from the node that finishes last, each step to a neighbor that finishes just in time.
+     * Such a neighbor has no slack either. This will grow linearly on the persist arena.
+     */
+    result.path.nodes = m_arena_alloc_internal(graph->persist_arena, sizeof(NAG_Idx) * 1, sizeof(NAG_Idx), false);
+    NAG_Idx node = last;
+    while (node != NAG_UNDISCOVERED) {
+        result.path.nodes[result.path.n_nodes++] = node;
+        if (!linear_alloc_nodes(graph->persist_arena, 1)) {
+            /* Persist arena is full. Report error. */
+        }
+        NAG_Idx next = NAG_UNDISCOVERED;
+        for (NAG_EdgeIdx e = graph->offsets[node]; e < graph->offsets[node + 1]; e++) {
+            NAG_Idx neighbor = graph->targets[e];
+            if (start[neighbor] + nag_node_weight(graph, neighbor) + nag_edge_weight(graph, e) == start[node]) {
+                next = neighbor;
+                break;
+            }
+        }
+        node = next;
+    }
+    /* Found root-first, flip it to leaf-first */
+    for (NAG_Idx i = 0; i < result.path.n_nodes / 2; i++) {
+        NAG_Idx tmp = result.path.nodes[i];
+        result.path.nodes[i] = result.path.nodes[result.path.n_nodes - 1 - i];
+        result.path.nodes[result.path.n_nodes - 1 - i] = tmp;
+    }
+
     m_arena_clear(graph->scratch_arena);
-    return sccs;
+    return result;
+}
+
+/*
+ * Work-stealing executor.
+ * Every worker owns a Chase-Lev deque: the owner pushes and pops at the bottom, while idle workers
+ * steal from the top. A node is pushed only once over a whole execution, so no deque ever holds more
+ * than n_nodes and its buffer never has to wrap around or grow.
+ */
+typedef struct {
+    _Atomic s64 top;
+    _Atomic s64 bottom;
+    _Atomic NAG_Idx *buffer; // of n_nodes len, on the worker arena
+    Arena arena;
+} NAG_ExecWorker;
+
+typedef struct {
+    NAG_Graph *graph;
+    NAG_Graph reversed;
+    NAG_Task task;
+    void *ctx;
+    u32 n_threads;
+    NAG_ExecWorker *workers;
+    _Atomic NAG_EdgeIdx *remaining; // neighbors of each node whose task has not completed
+    atomic_size_t n_outstanding; // nodes pushed that have not been run or skipped yet
+    atomic_size_t n_queued; // nodes sitting in a deque
+    atomic_size_t n_completed;
+    atomic_bool cancelled;
+    _Atomic NAG_Idx failed;
+    /* Idle workers sleep here instead of spinning while long tasks run */
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    atomic_uint n_sleeping;
+} NAG_Executor;
+
+typedef struct {
+    NAG_Executor *exec;
+    u32 id;
+} NAG_ExecWorkerArg;
+
+static void nag_exec_push(NAG_ExecWorker *worker, NAG_Idx node)
+{
+    s64 bottom = atomic_load_explicit(&worker->bottom, memory_order_relaxed);
+    atomic_store_explicit(&worker->buffer[bottom], node, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&worker->bottom, bottom + 1, memory_order_relaxed);
+}
+
+static bool nag_exec_pop(NAG_ExecWorker *worker, NAG_Idx *node)
+{
+    s64 bottom = atomic_load_explicit(&worker->bottom, memory_order_relaxed) - 1;
+    atomic_store_explicit(&worker->bottom, bottom, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    s64 top = atomic_load_explicit(&worker->top, memory_order_relaxed);
+    if (top > bottom) {
+        atomic_store_explicit(&worker->bottom, bottom + 1, memory_order_relaxed);
+        return false;
+    }
+    *node = atomic_load_explicit(&worker->buffer[bottom], memory_order_relaxed);
+    if (top != bottom) {
+        return true;
+    }
+    /* The last node in the deque, race the thieves for it */
+    bool taken = atomic_compare_exchange_strong_explicit(&worker->top, &top, top + 1, memory_order_seq_cst,
+                                                         memory_order_relaxed);
+    atomic_store_explicit(&worker->bottom, bottom + 1, memory_order_relaxed);
+    return taken;
+}
+
+static bool nag_exec_steal(NAG_ExecWorker *victim, NAG_Idx *node)
+{
+    s64 top = atomic_load_explicit(&victim->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    s64 bottom = atomic_load_explicit(&victim->bottom, memory_order_acquire);
+    if (top >= bottom) {
+        return false;
+    }
+    *node = atomic_load_explicit(&victim->buffer[top], memory_order_relaxed);
+    return atomic_compare_exchange_strong_explicit(&victim->top, &top, top + 1, memory_order_seq_cst,
+                                                   memory_order_relaxed);
+}
+
+/* Wakes a sleeping worker after a node has been pushed */
+static void nag_exec_notify(NAG_Executor *exec)
+{
+    atomic_fetch_add(&exec->n_queued, 1);
+    if (atomic_load(&exec->n_sleeping) != 0) {
+        pthread_mutex_lock(&exec->lock);
+        pthread_cond_signal(&exec->cond);
+        pthread_mutex_unlock(&exec->lock);
+    }
+}
+
+/* Sleeps until there is something to steal. Returns false once there never will be */
+static bool nag_exec_wait(NAG_Executor *exec)
+{
+    if (atomic_load(&exec->n_queued) != 0) {
+        return true;
+    }
+    pthread_mutex_lock(&exec->lock);
+    /* n_sleeping is raised before n_queued is checked, and the other way around in nag_exec_notify(),
+       so either this worker sees the node or the pusher sees this worker */
+    atomic_fetch_add(&exec->n_sleeping, 1);
+    while (atomic_load(&exec->n_queued) == 0 && atomic_load(&exec->n_outstanding) != 0) {
+        pthread_cond_wait(&exec->cond, &exec->lock);
+    }
+    atomic_fetch_sub(&exec->n_sleeping, 1);
+    bool more = atomic_load(&exec->n_outstanding) != 0;
+    pthread_mutex_unlock(&exec->lock);
+    return more;
+}
+
+static void nag_exec_run(NAG_Executor *exec, NAG_ExecWorker *self, NAG_Idx node)
+{
+    if (!atomic_load_explicit(&exec->cancelled, memory_order_relaxed)) {
+        if (exec->task(node, exec->ctx)) {
+            atomic_fetch_add_explicit(&exec->n_completed, 1, memory_order_relaxed);
+            /* Newly ready nodes are counted before this one is, so n_outstanding can't reach zero early */
+            NAG_Graph *reversed = &exec->reversed;
+            for (NAG_EdgeIdx e = reversed->offsets[node]; e < reversed->offsets[node + 1]; e++) {
+                NAG_Idx dependent = reversed->targets[e];
+                /* acq_rel so the task of dependent sees what the tasks of all its neighbors wrote */
+                if (atomic_fetch_sub_explicit(&exec->remaining[dependent], 1, memory_order_acq_rel) == 1) {
+                    atomic_fetch_add_explicit(&exec->n_outstanding, 1, memory_order_relaxed);
+                    nag_exec_push(self, dependent);
+                    nag_exec_notify(exec);
+                }
+            }
+        } else {
+            NAG_Idx none = NAG_UNDISCOVERED;
+            atomic_compare_exchange_strong(&exec->failed, &none, node);
+            atomic_store_explicit(&exec->cancelled, true, memory_order_relaxed);
+        }
+    }
+
+    if (atomic_fetch_sub(&exec->n_outstanding, 1) == 1) {
+        pthread_mutex_lock(&exec->lock);
+        pthread_cond_broadcast(&exec->cond);
+        pthread_mutex_unlock(&exec->lock);
+    }
+}
+
+static void *nag_exec_worker(void *arg)
+{
+    NAG_Executor *exec = ((NAG_ExecWorkerArg *)arg)->exec;
+    u32 id = ((NAG_ExecWorkerArg *)arg)->id;
+    NAG_ExecWorker *self = &exec->workers[id];
+
+    while (1) {
+        NAG_Idx node;
+        bool found = nag_exec_pop(self, &node);
+        for (u32 i = 1; !found && i < exec->n_threads; i++) {
+            found = nag_exec_steal(&exec->workers[(id + i) % exec->n_threads], &node);
+        }
+        if (!found) {
+            if (!nag_exec_wait(exec)) {
+                return NULL;
+            }
+            continue;
+        }
+        atomic_fetch_sub(&exec->n_queued, 1);
+        nag_exec_run(exec, self, node);
+    }
+}
+
+NAG_Execution nag_execute(NAG_Graph *graph, u32 n_threads, NAG_Task task, void *ctx)
+{
+    assert(graph->targets != NULL && "graph must be frozen");
+    if (n_threads == 0) {
+        n_threads = 1;
+    }
+
+    NAG_Executor exec = { .graph = graph, .reversed = nag_transpose(graph), .task = task, .ctx = ctx,
+                          .n_threads = n_threads };
+    exec.remaining = m_arena_alloc(graph->scratch_arena, sizeof(NAG_EdgeIdx) * graph->n_nodes);
+    exec.workers = m_arena_alloc(graph->scratch_arena, sizeof(NAG_ExecWorker) * n_threads);
+    NAG_ExecWorkerArg *args = m_arena_alloc(graph->scratch_arena, sizeof(NAG_ExecWorkerArg) * n_threads);
+    NAG_WorkerThread *threads = m_arena_alloc(graph->scratch_arena, sizeof(NAG_WorkerThread) * n_threads);
+    for (u32 t = 0; t < n_threads; t++) {
+        NAG_ExecWorker *worker = &exec.workers[t];
+        /* Room for every node, but only the pages of the deque that are touched get backed by memory */
+        nag_thread_arena_init(&worker->arena, sizeof(NAG_Idx) * ((size_t)graph->n_nodes + 1));
+        worker->buffer = m_arena_alloc(&worker->arena, sizeof(NAG_Idx) * graph->n_nodes);
+        atomic_init(&worker->top, 0);
+        atomic_init(&worker->bottom, 0);
+        args[t] = (NAG_ExecWorkerArg){ .exec = &exec, .id = t };
+    }
+
+    /* The calling thread is worker 0. Only the deques of workers that actually started are used */
+    pthread_mutex_init(&exec.lock, NULL);
+    pthread_cond_init(&exec.cond, NULL);
+    pthread_mutex_t gate = PTHREAD_MUTEX_INITIALIZER;
+    pthread_mutex_lock(&gate);
+    exec.n_threads = nag_start_workers(&gate, threads, n_threads, nag_exec_worker, args, sizeof(NAG_ExecWorkerArg));
+
+    /* Nodes without neighbors are ready from the start, dealt round-robin over the deques */
+    size_t n_ready = 0;
+    for (NAG_Idx node = 0; node < graph->n_nodes; node++) {
+        NAG_EdgeIdx out_degree = graph->offsets[node + 1] - graph->offsets[node];
+        atomic_init(&exec.remaining[node], out_degree);
+        if (out_degree == 0) {
+            nag_exec_push(&exec.workers[n_ready % exec.n_threads], node);
+            n_ready++;
+        }
+    }
+    atomic_init(&exec.n_outstanding, n_ready);
+    atomic_init(&exec.n_queued, n_ready);
+    atomic_init(&exec.n_completed, 0);
+    atomic_init(&exec.cancelled, false);
+    atomic_init(&exec.failed, NAG_UNDISCOVERED);
+    atomic_init(&exec.n_sleeping, 0);
+
+    pthread_mutex_unlock(&gate);
+    nag_exec_worker(&args[0]);
+    nag_join_workers(threads, exec.n_threads);
+    pthread_cond_destroy(&exec.cond);
+    pthread_mutex_destroy(&exec.lock);
+
+    for (u32 t = 0; t < n_threads; t++) {
+        m_arena_release(&exec.workers[t].arena);
+    }
+    m_arena_clear(graph->scratch_arena);
+    return (NAG_Execution){ .n_completed = atomic_load(&exec.n_completed), .failed = atomic_load(&exec.failed) };
+}
+
+NAG_DynTopo nag_make_dyn_topo(NAG_Graph *graph)
+{
+    assert(graph->targets == NULL && "edges can not be added to a frozen graph");
+    NAG_DynTopo topo = { .graph = graph, .order = nag_rev_toposort(graph) };
+    topo.rev_list = m_arena_alloc_zero(graph->persist_arena, sizeof(NAG_GraphNode *) * graph->n_nodes);
+    topo.position = m_arena_alloc(graph->persist_arena, sizeof(NAG_Idx) * graph->n_nodes);
+    topo.query = nag_make_query(graph);
+
+    for (NAG_Idx i = 0; i < graph->n_nodes; i++) {
+        topo.position[topo.order.nodes[i]] = i;
+        for (NAG_GraphNode *n = graph->neighbor_list[i]; n != NULL; n = n->next) {
+            NAG_GraphNode *rev = m_arena_alloc(graph->persist_arena, sizeof(NAG_GraphNode));
+            rev->id = i;
+            rev->next = topo.rev_list[n->id];
+            topo.rev_list[n->id] = rev;
+        }
+    }
+    return topo;
+}
+
+/*
+ * Collects the nodes reachable from start through lists, stopping at nodes whose position is outside
+ * of [lower, upper]. Returns how many were found, or 0 if stop_node was reached.
+ */
+static size_t nag_dyn_topo_search(NAG_DynTopo *topo, NAG_GraphNode **lists, NAG_Idx start, NAG_Idx lower,
+                                  NAG_Idx upper, NAG_Idx stop_node, NAG_Idx *stack, NAG_Idx *found)
+{
+    size_t n_found = 0;
+    size_t stack_top = 1;
+    stack[0] = start;
+    nag_set_visited(&topo->query, start);
+
+    while (stack_top != 0) {
+        NAG_Idx node = stack[--stack_top];
+        found[n_found++] = node;
+        for (NAG_GraphNode *n = lists[node]; n != NULL; n = n->next) {
+            if (n->id == stop_node) {
+                return 0;
+            }
+            NAG_Idx position = topo->position[n->id];
+            if (position < lower || position > upper || nag_is_visited(&topo->query, n->id)) {
+                continue;
+            }
+            nag_set_visited(&topo->query, n->id);
+            stack[stack_top++] = n->id;
+        }
+    }
+    return n_found;
+}
+
+static int nag_compare_idx(const void *a, const void *b)
+{
+    NAG_Idx x = *(const NAG_Idx *)a;
+    NAG_Idx y = *(const NAG_Idx *)b;
+    return (x > y) - (x < y);
+}
+
+bool nag_dyn_topo_add_edge(NAG_DynTopo *topo, NAG_Idx from, NAG_Idx to)
+{
+    NAG_Graph *graph = topo->graph;
+    if (from == to) {
+        return false;
+    }
+
+    /* Leaf-first, so to must come before from. If it already does, the order stays valid */
+    NAG_Idx lower = topo->position[from];
+    NAG_Idx upper = topo->position[to];
+    if (upper > lower) {
+        /* Everything we allocate on the scratch arena will be released before we returned */
+        ArenaTmp tmp_arena = m_arena_tmp_init(graph->scratch_arena);
+        NAG_Idx *stack = m_arena_alloc(graph->scratch_arena, sizeof(NAG_Idx) * graph->n_nodes);
+        NAG_Idx *moved = m_arena_alloc(graph->scratch_arena, sizeof(NAG_Idx) * graph->n_nodes);
+        NAG_Idx *slots = m_arena_alloc(graph->scratch_arena, sizeof(NAG_Idx) * graph->n_nodes);
+
+        /*
+         * Nodes in the affected region that depend on from must end up after to. If to is one of
+         * them, to already depends on from and the edge closes a cycle.
+         */
+        nag_query_begin(&topo->query);
+        size_t n_after = nag_dyn_topo_search(topo, topo->rev_list, from, lower, upper, to, stack, moved);
+        if (n_after == 0) {
+            m_arena_tmp_release(tmp_arena);
+            return false;
+        }
+        /* Nodes in the affected region that to depends on must end up before from */
+        size_t n_before = nag_dyn_topo_search(topo, graph->neighbor_list, to, lower, upper, NAG_UNDISCOVERED,
+                                              stack, moved + n_after);
+
+        /*
+         * Both sets keep their relative order, and together reuse the positions they occupied:
+         * the lowest positions go to the nodes that must come first.
+         */
+        size_t n_moved = n_after + n_before;
+        for (size_t i = 0; i < n_moved; i++) {
+            moved[i] = topo->position[moved[i]];
+        }
+        qsort(moved, n_after, sizeof(NAG_Idx), nag_compare_idx);
+        qsort(moved + n_after, n_before, sizeof(NAG_Idx), nag_compare_idx);
+        memcpy(slots, moved, sizeof(NAG_Idx) * n_moved);
+        qsort(slots, n_moved, sizeof(NAG_Idx), nag_compare_idx);
+
+        /* Look up the nodes before the order is overwritten. The nodes that must come first go first */
+        NAG_Idx *nodes = stack;
+        for (size_t i = 0; i < n_before; i++) {
+            nodes[i] = topo->order.nodes[moved[n_after + i]];
+        }
+        for (size_t i = 0; i < n_after; i++) {
+            nodes[n_before + i] = topo->order.nodes[moved[i]];
+        }
+        for (size_t i = 0; i < n_moved; i++) {
+            topo->order.nodes[slots[i]] = nodes[i];
+            topo->position[nodes[i]] = slots[i];
+        }
+        m_arena_tmp_release(tmp_arena); /* Reclaims the memory to the arena, not to the OS */
+    }
+
+    nag_add_edge(graph, from, to);
+    NAG_GraphNode *rev = m_arena_alloc(graph->persist_arena, sizeof(NAG_GraphNode));
+    rev->id = from;
+    rev->next = topo->rev_list[to];
+    topo->rev_list[to] = rev;
+    return true;
+}
+
+static inline bool node_on_stack(NAG_Idx *stack, u32 stack_top, NAG_Idx node)
+{
+    for (u32 i = stack_top; i > 0; i--) {
+        if (stack[i] == node) {
+            return true;
+        }
+    }
+    return false;
+}
+
+typedef struct nag_tarjan_context_t NAG_TarjanContext;
+/* Called for the root of every SCC. Must pop the SCC off ctx->stack, down to and including root */
+typedef void (*NAG_TarjanEmit)(NAG_Graph *graph, NAG_TarjanContext *ctx, NAG_Idx root);
+
+struct nag_tarjan_context_t {
+    NAG_Idx *stack;
+    bool *on_stack;
+    NAG_Idx *low_link;
+    NAG_Idx *discovery_time;
+    NAG_Idx time;
+    NAG_Idx stack_top;
+    /* Explicit call stack replacing recursion. Will grow linearly on the scratch arena */
+    NAG_DfsFrame *frames;
+    size_t frames_size;
+    Arena *scratch_arena;
+    NAG_TarjanEmit emit;
+    void *emit_ctx;
+    /* If set, only nodes of this color are searched. Used by the parallel SCC on its partitions */
+    _Atomic u64 *color;
+    u64 only_color;
+};
+
+static inline void nag_tarjan_discover(NAG_Graph *graph, NAG_TarjanContext *ctx, NAG_DfsFrame *frame,
+                                       NAG_Idx node)
+{
+    ctx->discovery_time[node] = ctx->time;
+    ctx->low_link[node] = ctx->time;
+    ctx->time++;
+    ctx->stack[ctx->stack_top++] = node;
+    ctx->on_stack[node] = true;
+    frame->node = node;
+    frame->it = nag_neighbors(graph, node);
+}
+
+static void nag_tarjan_scc_from(NAG_Graph *graph, NAG_Idx root, NAG_TarjanContext *ctx)
+{
+    size_t frames_top = 1;
+    nag_tarjan_discover(graph, ctx, &ctx->frames[0], root);
+
+    while (frames_top != 0) {
+        NAG_DfsFrame *frame = &ctx->frames[frames_top - 1];
+        NAG_Idx node = frame->node;
+        NAG_Idx neighbor_id;
+
+        if (nag_next_neighbor(&frame->it, &neighbor_id)) {
+            if (ctx->color != NULL
+                && atomic_load_explicit(&ctx->color[neighbor_id], memory_order_relaxed) != ctx->only_color) {
+                continue;
+            }
+            if (ctx->discovery_time[neighbor_id] == NAG_UNDISCOVERED) {
+                /* If neighbor is not yet visited, descend into it */
+                if (frames_top == ctx->frames_size) {
+                    if (!alloc_frames(ctx->scratch_arena, NAG_STACK_GROW_SIZE)) {
+                        /* Scratch arena is full. Report error. */
+                    }
+                    ctx->frames_size += NAG_STACK_GROW_SIZE;
+                }
+                nag_tarjan_discover(graph, ctx, &ctx->frames[frames_top++], neighbor_id);
+            } else if (ctx->on_stack[neighbor_id]) {
+                /* Update low-link value if the neighbor is on the stack */
+                ctx->low_link[node] = NAG_MIN(ctx->low_link[node], ctx->discovery_time[neighbor_id]);
+            }
+            continue;
+        }
+
+        /* All neighbors are done. Return to the parent and propagate the low-link value */
+        frames_top--;
+        if (frames_top != 0) {
+            NAG_Idx parent = ctx->frames[frames_top - 1].node;
+            ctx->low_link[parent] = NAG_MIN(ctx->low_link[parent], ctx->low_link[node]);
+        }
+
+        /* If node is a root node, the SCC is everything above it on the stack */
+        if (ctx->low_link[node] == ctx->discovery_time[node]) {
+            ctx->emit(graph, ctx, node);
+        }
+    }
+}
+
+/* Runs Tarjan over the whole graph. The emitted SCCs come in reverse topological order */
+static void nag_tarjan(NAG_Graph *graph, NAG_TarjanEmit emit, void *emit_ctx)
+{
+    NAG_TarjanContext ctx;
+    ctx.stack = m_arena_alloc(graph->scratch_arena, sizeof(NAG_Idx) * graph->n_nodes);
+    ctx.on_stack = m_arena_alloc(graph->scratch_arena, sizeof(bool) * graph->n_nodes);
+    ctx.low_link = m_arena_alloc(graph->scratch_arena, sizeof(NAG_Idx) * graph->n_nodes);
+    ctx.discovery_time = m_arena_alloc(graph->scratch_arena, sizeof(NAG_Idx) * graph->n_nodes);
+    ctx.time = 0;
+    ctx.stack_top = 0;
+    /* Must be the last allocation on the scratch arena so the frames can grow linearly */
+    ctx.frames_size = NAG_STACK_GROW_SIZE;
+    ctx.frames = alloc_frames(graph->scratch_arena, ctx.frames_size);
+    ctx.scratch_arena = graph->scratch_arena;
+    ctx.emit = emit;
+    ctx.emit_ctx = emit_ctx;
+    ctx.color = NULL;
+
+    memset(ctx.on_stack, false, sizeof(bool) * graph->n_nodes);
+    memset(ctx.discovery_time, 0xff, sizeof(NAG_Idx) * graph->n_nodes); /* NAG_UNDISCOVERED has all bits set */
+
+    for (NAG_Idx i = 0; i < graph->n_nodes; i++) {
+        if (ctx.discovery_time[i] == NAG_UNDISCOVERED) {
+            nag_tarjan_scc_from(graph, i, &ctx);
+        }
+    }
+
+    m_arena_clear(graph->scratch_arena);
+}
+
+static void nag_tarjan_emit_order(NAG_Graph *graph, NAG_TarjanContext *ctx, NAG_Idx root)
+{
+    NAG_OrderList *sccs = ctx->emit_ctx;
+
+    /* This implemention does not care about trivial scc's, so don't bother storing them */
+    if (ctx->stack[ctx->stack_top - 1] == root) {
+        ctx->stack_top--;
+        ctx->on_stack[root] = false;
+        return;
+    }
+
+    NAG_Order scc = {0};
+    /* This will grow linearly on the persist arena as we add nodes to the order */
+    scc.nodes = m_arena_alloc(graph->persist_arena, sizeof(NAG_Idx) * 1);
+
+    while (1) {
+        NAG_Idx top = ctx->stack[--ctx->stack_top];
+        ctx->on_stack[top] = false;
+        scc.nodes[scc.n_nodes++] = top;
+        if (!linear_alloc_nodes(graph->persist_arena, 1)) {
+            /* Persist arena is full. Report error. */
+        }
+        if (top == root) break;
+    }
+
+    if (sccs->n == 0 || sccs->n % 8 == 0) { // TODO: this is hacky
+        sccs->orders = realloc(sccs->orders, sizeof(NAG_Order) * (sccs->n + 8));
+    }
+    sccs->orders[sccs->n++] = scc;
+}
+
+NAG_OrderList nag_scc(NAG_Graph *graph) {
+    NAG_OrderList sccs;
+    sccs.n = 0;
+    sccs.orders = malloc(sizeof(NAG_Order) * sccs.n);
+    nag_tarjan(graph, nag_tarjan_emit_order, &sccs);
+    return sccs;
+}
+
+static void nag_tarjan_emit_flat(NAG_Graph *graph, NAG_TarjanContext *ctx, NAG_Idx root)
+{
+    (void)graph;
+    NAG_FlatOrderList *sccs = ctx->emit_ctx;
+
+    /* Same as nag_tarjan_emit_order(), trivial scc's are left out */
+    if (ctx->stack[ctx->stack_top - 1] == root) {
+        ctx->stack_top--;
+        ctx->on_stack[root] = false;
+        return;
+    }
+
+    NAG_Idx nodes_len = sccs->offsets[sccs->n];
+    while (1) {
+        NAG_Idx top = ctx->stack[--ctx->stack_top];
+        ctx->on_stack[top] = false;
+        sccs->nodes[nodes_len++] = top;
+        if (top == root) break;
+    }
+    sccs->offsets[++sccs->n] = nodes_len;
+}
+
+NAG_FlatOrderList nag_scc_flat(NAG_Graph *graph, Arena *arena)
+{
+    NAG_FlatOrderList sccs = nag_make_flat_order_list(graph, arena);
+    nag_tarjan(graph, nag_tarjan_emit_flat, &sccs);
+    return sccs;
+}
+
+static void nag_tarjan_emit_condensed(NAG_Graph *graph, NAG_TarjanContext *ctx, NAG_Idx root)
+{
+    (void)graph;
+    NAG_Condensation *condensed = ctx->emit_ctx;
+    NAG_Idx id = condensed->dag.n_nodes++;
+    NAG_Idx members_len = condensed->member_offsets[id];
+
+    while (1) {
+        NAG_Idx top = ctx->stack[--ctx->stack_top];
+        ctx->on_stack[top] = false;
+        condensed->component[top] = id;
+        condensed->members[members_len++] = top;
+        if (top == root) break;
+    }
+    condensed->member_offsets[id + 1] = members_len;
+}
+
+NAG_Condensation nag_condense(NAG_Graph *graph)
+{
+    NAG_Condensation condensed = { 0 };
+    condensed.component = m_arena_alloc(graph->persist_arena, sizeof(NAG_Idx) * graph->n_nodes);
+    condensed.members = m_arena_alloc(graph->persist_arena, sizeof(NAG_Idx) * graph->n_nodes);
+    /* There can be at most one SCC per node */
+    condensed.member_offsets = m_arena_alloc(graph->persist_arena, sizeof(NAG_Idx) * ((size_t)graph->n_nodes + 1));
+    condensed.member_offsets[0] = 0;
+    nag_tarjan(graph, nag_tarjan_emit_condensed, &condensed);
+
+    NAG_Graph *dag = &condensed.dag;
+    dag->persist_arena = graph->persist_arena;
+    dag->scratch_arena = graph->scratch_arena;
+    dag->offsets = m_arena_alloc(graph->persist_arena, sizeof(NAG_EdgeIdx) * ((size_t)dag->n_nodes + 1));
+    /* This will grow linearly on the persist arena as we add edges */
+    dag->targets = m_arena_alloc_internal(graph->persist_arena, sizeof(NAG_Idx) * 1, sizeof(NAG_Idx), false);
+
+    /* last_source[d] is the last SCC that got an edge to d, which is all it takes to skip duplicates */
+    NAG_Idx *last_source = m_arena_alloc(graph->scratch_arena, sizeof(NAG_Idx) * dag->n_nodes);
+    memset(last_source, 0xff, sizeof(NAG_Idx) * dag->n_nodes); /* NAG_UNDISCOVERED has all bits set */
+
+    for (NAG_Idx c = 0; c < dag->n_nodes; c++) {
+        dag->offsets[c] = dag->n_edges;
+        for (NAG_Idx m = condensed.member_offsets[c]; m < condensed.member_offsets[c + 1]; m++) {
+            NAG_NeighborIter it = nag_neighbors(graph, condensed.members[m]);
+            NAG_Idx neighbor;
+            while (nag_next_neighbor(&it, &neighbor)) {
+                NAG_Idx d = condensed.component[neighbor];
+                if (d == c || last_source[d] == c) {
+                    continue;
+                }
+                last_source[d] = c;
+                dag->targets[dag->n_edges++] = d;
+                if (!linear_alloc_nodes(graph->persist_arena, 1)) {
+                    /* Persist arena is full. Report error. */
+                }
+            }
+        }
+    }
+    dag->offsets[dag->n_nodes] = dag->n_edges;
+
+    m_arena_clear(graph->scratch_arena);
+    return condensed;
+}
+
+/*
+ * Parallel SCC.
+ * Trimming first removes every node with no incoming or no outgoing edges among the remaining nodes,
+ * as those are trivial SCCs. Each worker seeds its own slice of the nodes and keeps peeling from a
+ * local stack, so long chains are trimmed without a barrier per step. What remains is decomposed with
+ * forward-backward: nodes both reachable from and reaching a pivot form the SCC of the pivot, and the
+ * nodes only reached forward, only reached backward, and not reached at all form three independent
+ * partitions that can be processed in parallel. Nodes of a partition share a color, so searches stay
+ * within their partition. Every partition is trimmed again before its split (FW-BW-Trim), and the
+ * pivot is picked at random, as always taking the same end of a chain of SCCs peels off a single SCC
+ * per split. Partitions of at most NAG_SCC_TARJAN_THRESHOLD nodes are finished with Tarjan instead.
+ */
+#define NAG_COLOR_DONE 0 // trimmed or assigned to an SCC
+
+typedef struct {
+    NAG_Idx *nodes; // a slice of NAG_ParallelScc.nodes, owned by whichever worker processes the partition
+    size_t n_nodes;
+    u64 color;
+} NAG_SccPartition;
+
+typedef struct {
+    Arena arena; // holds the trim stack, then the search queues and the split buffer or the Tarjan stacks
+    u64 rng; // splitmix64 state for picking pivots
+} NAG_SccWorker;
+
+typedef struct {
+    NAG_Graph *graph;
+    NAG_Graph reversed;
+    u32 n_threads;
+    NAG_SccWorker *workers;
+    pthread_barrier_t barrier;
+
+    /* Trimming */
+    _Atomic NAG_EdgeIdx *in_degree; // edges from nodes not yet trimmed
+    _Atomic NAG_EdgeIdx *out_degree;
+    atomic_bool *trimmed;
+
+    /* Forward-backward. Entries of a node are only touched by the worker owning its partition */
+    _Atomic u64 *color;
+    u8 *reached; // bit 0 forward, bit 1 backward
+    NAG_Idx *nodes; // the nodes that survived the first trim. Splitting a partition reorders its slice in place
+    /* For Tarjan on small partitions */
+    bool *on_stack;
+    NAG_Idx *low_link;
+    NAG_Idx *discovery_time;
+    atomic_ullong next_color;
+    pthread_mutex_t lock; // protects everything below
+    pthread_cond_t cond;
+    NAG_SccPartition *partitions; // NOTE: Heap allocated. Stack of partitions waiting to be processed
+    size_t n_partitions;
+    size_t partitions_allocated;
+    u32 n_busy; // workers currently processing a partition
+    NAG_OrderList *sccs;
+} NAG_ParallelScc;
+
+typedef struct {
+    NAG_ParallelScc *scc;
+    u32 id;
+} NAG_SccWorkerArg;
+
+typedef struct {
+    NAG_Idx *nodes;
+    size_t top;
+    size_t size;
+    Arena *arena;
+} NAG_TrimStack;
+
+static inline void nag_scc_trim_claim(NAG_ParallelScc *scc, NAG_TrimStack *stack, NAG_Idx node)
+{
+    if (atomic_exchange_explicit(&scc->trimmed[node], true, memory_order_relaxed)) {
+        return;
+    }
+    stack->nodes[stack->top++] = node;
+    if (stack->top == stack->size) {
+        /* Can not fail, the worker arena has room for trimming every node. Not inside the assert, it must run */
+        bool grown = linear_alloc_nodes(stack->arena, NAG_STACK_GROW_SIZE);
+        assert(grown && "worker arena is sized for every node");
+        (void)grown;
+        stack->size += NAG_STACK_GROW_SIZE;
+    }
+}
+
+static void nag_scc_trim(NAG_ParallelScc *scc, NAG_SccWorker *self, u32 id)
+{
+    NAG_Graph *graph = scc->graph;
+    /* Will grow linearly on the worker arena */
+    NAG_TrimStack stack = { .size = NAG_STACK_GROW_SIZE, .arena = &self->arena };
+    stack.nodes = m_arena_alloc_internal(&self->arena, sizeof(NAG_Idx) * stack.size, sizeof(NAG_Idx), false);
+
+    size_t slice_start = (size_t)graph->n_nodes * id / scc->n_threads;
+    size_t slice_end = (size_t)graph->n_nodes * (id + 1) / scc->n_threads;
+    for (size_t node = slice_start; node < slice_end; node++) {
+        if (atomic_load_explicit(&scc->in_degree[node], memory_order_relaxed) == 0
+            || atomic_load_explicit(&scc->out_degree[node], memory_order_relaxed) == 0) {
+            nag_scc_trim_claim(scc, &stack, node);
+        }
+
+        /* Peel everything that trimming this node exposes before moving on */
+        while (stack.top != 0) {
+            NAG_Idx trimmed = stack.nodes[--stack.top];
+            for (NAG_EdgeIdx e = graph->offsets[trimmed]; e < graph->offsets[trimmed + 1]; e++) {
+                NAG_Idx neighbor = graph->targets[e];
+                if (atomic_fetch_sub_explicit(&scc->in_degree[neighbor], 1, memory_order_relaxed) == 1) {
+                    nag_scc_trim_claim(scc, &stack, neighbor);
+                }
+            }
+            for (NAG_EdgeIdx e = scc->reversed.offsets[trimmed]; e < scc->reversed.offsets[trimmed + 1]; e++) {
+                NAG_Idx neighbor = scc->reversed.targets[e];
+                if (atomic_fetch_sub_explicit(&scc->out_degree[neighbor], 1, memory_order_relaxed) == 1) {
+                    nag_scc_trim_claim(scc, &stack, neighbor);
+                }
+            }
+        }
+    }
+    m_arena_clear(&self->arena);
+}
+
+/* Must hold scc->lock */
+static void nag_scc_push_partition(NAG_ParallelScc *scc, NAG_SccPartition partition)
+{
+    if (scc->n_partitions == scc->partitions_allocated) {
+        scc->partitions_allocated += 8;
+        scc->partitions = realloc(scc->partitions, sizeof(NAG_SccPartition) * scc->partitions_allocated);
+    }
+    scc->partitions[scc->n_partitions++] = partition;
+}
+
+/* Must not hold scc->lock. This implemention does not care about trivial scc's */
+static void nag_scc_add(NAG_ParallelScc *scc, NAG_Idx *nodes, size_t n_nodes)
+{
+    if (n_nodes < 2) {
+        return;
+    }
+    pthread_mutex_lock(&scc->lock);
+    NAG_Order order = { .n_nodes = n_nodes };
+    order.nodes = m_arena_alloc(scc->graph->persist_arena, sizeof(NAG_Idx) * order.n_nodes);
+    memcpy(order.nodes, nodes, sizeof(NAG_Idx) * order.n_nodes);
+    if (scc->sccs->n % 8 == 0) {
+        scc->sccs->orders = realloc(scc->sccs->orders, sizeof(NAG_Order) * (scc->sccs->n + 8));
+    }
+    scc->sccs->orders[scc->sccs->n++] = order;
+    pthread_mutex_unlock(&scc->lock);
+}
+
+static void nag_scc_emit_partition(NAG_Graph *graph, NAG_TarjanContext *ctx, NAG_Idx root)
+{
+    (void)graph;
+    NAG_Idx bottom = ctx->stack_top;
+    do {
+        bottom--;
+        ctx->on_stack[ctx->stack[bottom]] = false;
+    } while (ctx->stack[bottom] != root);
+    nag_scc_add(ctx->emit_ctx, ctx->stack + bottom, ctx->stack_top - bottom);
+    ctx->stack_top = bottom;
+}
+
+/* Tarjan restricted to the partition, with the stacks on the worker arena */
+static void nag_scc_tarjan_partition(NAG_ParallelScc *scc, NAG_SccWorker *self, NAG_SccPartition *partition)
+{
+    NAG_TarjanContext ctx = { .on_stack = scc->on_stack, .low_link = scc->low_link,
+                              .discovery_time = scc->discovery_time, .time = 0, .stack_top = 0,
+                              .scratch_arena = &self->arena, .emit = nag_scc_emit_partition, .emit_ctx = scc,
+                              .color = scc->color, .only_color = partition->color };
+    ctx.stack = m_arena_alloc(&self->arena, sizeof(NAG_Idx) * partition->n_nodes);
+    /* Must be the last allocation on the worker arena so the frames can grow linearly */
+    ctx.frames_size = NAG_STACK_GROW_SIZE;
+    ctx.frames = alloc_frames(&self->arena, ctx.frames_size);
+    for (size_t i = 0; i < partition->n_nodes; i++) {
+        if (scc->discovery_time[partition->nodes[i]] == NAG_UNDISCOVERED) {
+            nag_tarjan_scc_from(scc->graph, partition->nodes[i], &ctx);
+        }
+    }
+}
+
+/*
+ * Trims the nodes with no incoming or no outgoing edges within the partition, and what that exposes,
+ * like nag_scc_trim() does for the whole graph. Leaves the rest at the front of the partition.
+ * The degree counters of the first trim are reused, as the partition owns the entries of its nodes.
+ */
+static void nag_scc_trim_partition(NAG_ParallelScc *scc, NAG_SccWorker *self, NAG_SccPartition *partition)
+{
+    NAG_Graph *graph = scc->graph;
+    u64 color = partition->color;
+    for (size_t i = 0; i < partition->n_nodes; i++) {
+        NAG_Idx node = partition->nodes[i];
+        NAG_EdgeIdx in = 0, out = 0;
+        for (NAG_EdgeIdx e = scc->reversed.offsets[node]; e < scc->reversed.offsets[node + 1]; e++) {
+            in += atomic_load_explicit(&scc->color[scc->reversed.targets[e]], memory_order_relaxed) == color;
+        }
+        for (NAG_EdgeIdx e = graph->offsets[node]; e < graph->offsets[node + 1]; e++) {
+            out += atomic_load_explicit(&scc->color[graph->targets[e]], memory_order_relaxed) == color;
+        }
+        atomic_store_explicit(&scc->in_degree[node], in, memory_order_relaxed);
+        atomic_store_explicit(&scc->out_degree[node], out, memory_order_relaxed);
+    }
+
+    /* Every node is pushed at most once, as pushing it takes it out of the partition */
+    NAG_Idx *stack = m_arena_alloc(&self->arena, sizeof(NAG_Idx) * partition->n_nodes);
+    size_t stack_top = 0;
+    for (size_t i = 0; i < partition->n_nodes; i++) {
+        NAG_Idx node = partition->nodes[i];
+        if (atomic_load_explicit(&scc->color[node], memory_order_relaxed) != color
+            || (atomic_load_explicit(&scc->in_degree[node], memory_order_relaxed) != 0
+                && atomic_load_explicit(&scc->out_degree[node], memory_order_relaxed) != 0)) {
+            continue;
+        }
+        atomic_store_explicit(&scc->color[node], NAG_COLOR_DONE, memory_order_relaxed);
+        stack[stack_top++] = node;
+        while (stack_top != 0) {
+            NAG_Idx trimmed = stack[--stack_top];
+            for (NAG_EdgeIdx e = graph->offsets[trimmed]; e < graph->offsets[trimmed + 1]; e++) {
+                NAG_Idx neighbor = graph->targets[e];
+                if (atomic_load_explicit(&scc->color[neighbor], memory_order_relaxed) == color
+                    && atomic_fetch_sub_explicit(&scc->in_degree[neighbor], 1, memory_order_relaxed) == 1) {
+                    atomic_store_explicit(&scc->color[neighbor], NAG_COLOR_DONE, memory_order_relaxed);
+                    stack[stack_top++] = neighbor;
+                }
+            }
+            for (NAG_EdgeIdx e = scc->reversed.offsets[trimmed]; e < scc->reversed.offsets[trimmed + 1]; e++) {
+                NAG_Idx neighbor = scc->reversed.targets[e];
+                if (atomic_load_explicit(&scc->color[neighbor], memory_order_relaxed) == color
+                    && atomic_fetch_sub_explicit(&scc->out_degree[neighbor], 1, memory_order_relaxed) == 1) {
+                    atomic_store_explicit(&scc->color[neighbor], NAG_COLOR_DONE, memory_order_relaxed);
+                    stack[stack_top++] = neighbor;
+                }
+            }
+        }
+    }
+
+    size_t n_left = 0;
+    for (size_t i = 0; i < partition->n_nodes; i++) {
+        if (atomic_load_explicit(&scc->color[partition->nodes[i]], memory_order_relaxed) == color) {
+            partition->nodes[n_left++] = partition->nodes[i];
+        }
+    }
+    partition->n_nodes = n_left;
+    m_arena_clear(&self->arena);
+}
+
+/* BFS from the pivot within its partition, setting the given bit in reached on every node found */
+static void nag_scc_reach(NAG_ParallelScc *scc, NAG_SccWorker *self, NAG_Graph *graph, NAG_SccPartition *partition,
+                          NAG_Idx pivot, u8 bit)
+{
+    /* A search never leaves its partition, so the queue never outgrows it */
+    NAG_Idx *queue = m_arena_alloc(&self->arena, sizeof(NAG_Idx) * partition->n_nodes);
+    size_t queue_low = 0;
+    size_t queue_high = 1;
+    queue[0] = pivot;
+    scc->reached[pivot] |= bit;
+
+    while (queue_low != queue_high) {
+        NAG_Idx node = queue[queue_low++];
+        for (NAG_EdgeIdx e = graph->offsets[node]; e < graph->offsets[node + 1]; e++) {
+            NAG_Idx neighbor = graph->targets[e];
+            /* The color is checked first, as reached of nodes in other partitions belongs to other workers */
+            if (atomic_load_explicit(&scc->color[neighbor], memory_order_relaxed) != partition->color) {
+                continue;
+            }
+            if (scc->reached[neighbor] & bit) {
+                continue;
+            }
+            scc->reached[neighbor] |= bit;
+            queue[queue_high++] = neighbor;
+        }
+    }
+    m_arena_clear(&self->arena);
+}
+
+static void nag_scc_process_partition(NAG_ParallelScc *scc, NAG_SccWorker *self, NAG_SccPartition partition)
+{
+    enum { REACHED_FORWARD = 1, REACHED_BACKWARD = 2, REACHED_BOTH = 3 };
+
+    if (partition.n_nodes <= NAG_SCC_TARJAN_THRESHOLD) {
+        nag_scc_tarjan_partition(scc, self, &partition);
+        return;
+    }
+    nag_scc_trim_partition(scc, self, &partition);
+    if (partition.n_nodes == 0) {
+        return;
+    }
+
+    /* splitmix64 */
+    u64 z = (self->rng += 0x9e3779b97f4a7c15);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+    NAG_Idx pivot = partition.nodes[(z ^ (z >> 31)) % partition.n_nodes];
+    nag_scc_reach(scc, self, scc->graph, &partition, pivot, REACHED_FORWARD);
+    nag_scc_reach(scc, self, &scc->reversed, &partition, pivot, REACHED_BACKWARD);
+
+    /*
+     * Bucket the nodes by how they were reached with a counting sort through the worker arena, so the
+     * new partitions are slices of this one. The SCC of the pivot is the nodes reached both ways.
+     */
+    size_t start[4] = { 0 };
+    for (size_t i = 0; i < partition.n_nodes; i++) {
+        start[scc->reached[partition.nodes[i]]]++;
+    }
+    NAG_SccPartition split[4];
+    size_t offset = 0;
+    for (u32 i = 0; i < 4; i++) {
+        split[i] = (NAG_SccPartition){ .nodes = partition.nodes + offset, .n_nodes = start[i] };
+        start[i] = offset;
+        offset += split[i].n_nodes;
+    }
+    NAG_Idx *buffer = m_arena_alloc(&self->arena, sizeof(NAG_Idx) * partition.n_nodes);
+    for (size_t i = 0; i < partition.n_nodes; i++) {
+        NAG_Idx node = partition.nodes[i];
+        buffer[start[scc->reached[node]]++] = node;
+        scc->reached[node] = 0;
+    }
+    memcpy(partition.nodes, buffer, sizeof(NAG_Idx) * partition.n_nodes);
+    m_arena_clear(&self->arena);
+
+    NAG_SccPartition *component = &split[REACHED_BOTH];
+    for (size_t i = 0; i < component->n_nodes; i++) {
+        atomic_store_explicit(&scc->color[component->nodes[i]], NAG_COLOR_DONE, memory_order_relaxed);
+    }
+    /* Recolor the rest so that the new partitions are searched independently */
+    for (u32 i = 0; i < REACHED_BOTH; i++) {
+        if (split[i].n_nodes == 0) {
+            continue;
+        }
+        split[i].color = atomic_fetch_add_explicit(&scc->next_color, 1, memory_order_relaxed);
+        for (size_t j = 0; j < split[i].n_nodes; j++) {
+            atomic_store_explicit(&scc->color[split[i].nodes[j]], split[i].color, memory_order_relaxed);
+        }
+    }
+    nag_scc_add(scc, component->nodes, component->n_nodes);
+
+    pthread_mutex_lock(&scc->lock);
+    for (u32 i = 0; i < REACHED_BOTH; i++) {
+        if (split[i].n_nodes != 0) {
+            nag_scc_push_partition(scc, split[i]);
+        }
+    }
+    pthread_cond_broadcast(&scc->cond);
+    pthread_mutex_unlock(&scc->lock);
+}
+
+static void *nag_scc_worker(void *arg)
+{
+    NAG_ParallelScc *scc = ((NAG_SccWorkerArg *)arg)->scc;
+    u32 id = ((NAG_SccWorkerArg *)arg)->id;
+    NAG_SccWorker *self = &scc->workers[id];
+    NAG_Graph *graph = scc->graph;
+
+    nag_scc_trim(scc, self, id);
+    pthread_barrier_wait(&scc->barrier);
+
+    /* Forward-backward: worker 0 gathers what survived the trim into the first partition */
+    if (id == 0) {
+        NAG_SccPartition first = { .nodes = scc->nodes, .color = atomic_fetch_add(&scc->next_color, 1) };
+        for (NAG_Idx node = 0; node < graph->n_nodes; node++) {
+            if (!atomic_load_explicit(&scc->trimmed[node], memory_order_relaxed)) {
+                atomic_store_explicit(&scc->color[node], first.color, memory_order_relaxed);
+                first.nodes[first.n_nodes++] = node;
+            }
+        }
+        if (first.n_nodes != 0) {
+            nag_scc_push_partition(scc, first);
+        }
+    }
+    pthread_barrier_wait(&scc->barrier);
+
+    pthread_mutex_lock(&scc->lock);
+    while (1) {
+        if (scc->n_partitions == 0) {
+            /* Nothing left and nobody can produce more */
+            if (scc->n_busy == 0) {
+                break;
+            }
+            pthread_cond_wait(&scc->cond, &scc->lock);
+            continue;
+        }
+        NAG_SccPartition partition = scc->partitions[--scc->n_partitions];
+        scc->n_busy++;
+        pthread_mutex_unlock(&scc->lock);
+
+        nag_scc_process_partition(scc, self, partition);
+        m_arena_clear(&self->arena);
+
+        pthread_mutex_lock(&scc->lock);
+        scc->n_busy--;
+    }
+    pthread_cond_broadcast(&scc->cond);
+    pthread_mutex_unlock(&scc->lock);
+    return NULL;
+}
+
+NAG_OrderList nag_scc_parallel(NAG_Graph *graph, u32 n_threads)
+{
+    if (n_threads <= 1) {
+        return nag_scc(graph);
+    }
+    NAG_OrderList sccs = {0};
+
+    NAG_ParallelScc scc = { .graph = graph, .reversed = nag_transpose(graph), .n_threads = n_threads, .sccs = &sccs };
+    scc.in_degree = m_arena_alloc(graph->scratch_arena, sizeof(NAG_EdgeIdx) * graph->n_nodes);
+    scc.out_degree = m_arena_alloc(graph->scratch_arena, sizeof(NAG_EdgeIdx) * graph->n_nodes);
+    scc.trimmed = m_arena_alloc(graph->scratch_arena, sizeof(atomic_bool) * graph->n_nodes);
+    scc.color = m_arena_alloc(graph->scratch_arena, sizeof(u64) * graph->n_nodes);
+    scc.reached = m_arena_alloc_zero(graph->scratch_arena, sizeof(u8) * graph->n_nodes);
+    scc.nodes = m_arena_alloc(graph->scratch_arena, sizeof(NAG_Idx) * graph->n_nodes);
+    scc.on_stack = m_arena_alloc_zero(graph->scratch_arena, sizeof(bool) * graph->n_nodes);
+    scc.low_link = m_arena_alloc(graph->scratch_arena, sizeof(NAG_Idx) * graph->n_nodes);
+    scc.discovery_time = m_arena_alloc(graph->scratch_arena, sizeof(NAG_Idx) * graph->n_nodes);
+    memset(scc.discovery_time, 0xff, sizeof(NAG_Idx) * graph->n_nodes); /* NAG_UNDISCOVERED has all bits set */
+    for (NAG_Idx node = 0; node < graph->n_nodes; node++) {
+        atomic_init(&scc.in_degree[node], scc.reversed.offsets[node + 1] - scc.reversed.offsets[node]);
+        atomic_init(&scc.out_degree[node], graph->offsets[node + 1] - graph->offsets[node]);
+        atomic_init(&scc.trimmed[node], false);
+        atomic_init(&scc.color[node], NAG_COLOR_DONE);
+    }
+    atomic_init(&scc.next_color, NAG_COLOR_DONE + 1);
+
+    scc.workers = m_arena_alloc(graph->scratch_arena, sizeof(NAG_SccWorker) * n_threads);
+    NAG_SccWorkerArg *args = m_arena_alloc(graph->scratch_arena, sizeof(NAG_SccWorkerArg) * n_threads);
+    NAG_WorkerThread *threads = m_arena_alloc(graph->scratch_arena, sizeof(NAG_WorkerThread) * n_threads);
+    for (u32 t = 0; t < n_threads; t++) {
+        NAG_SccWorker *worker = &scc.workers[t];
+        /* Room for trimming every node or splitting the largest partition, and for Tarjan on the smaller ones */
+        size_t max_bytes = sizeof(NAG_Idx) * 2 * ((size_t)graph->n_nodes + NAG_STACK_GROW_SIZE)
+                           + sizeof(NAG_DfsFrame) * (NAG_SCC_TARJAN_THRESHOLD + NAG_STACK_GROW_SIZE);
+        nag_thread_arena_init(&worker->arena, max_bytes);
+        worker->rng = t;
+        args[t] = (NAG_SccWorkerArg){ .scc = &scc, .id = t };
+    }
+
+    /* The calling thread is worker 0. The trim slices are split between the workers that actually started */
+    pthread_mutex_init(&scc.lock, NULL);
+    pthread_cond_init(&scc.cond, NULL);
+    pthread_mutex_t gate = PTHREAD_MUTEX_INITIALIZER;
+    pthread_mutex_lock(&gate);
+    scc.n_threads = nag_start_workers(&gate, threads, n_threads, nag_scc_worker, args, sizeof(NAG_SccWorkerArg));
+    pthread_barrier_init(&scc.barrier, NULL, scc.n_threads);
+    pthread_mutex_unlock(&gate);
+    nag_scc_worker(&args[0]);
+    nag_join_workers(threads, scc.n_threads);
+    pthread_cond_destroy(&scc.cond);
+    pthread_mutex_destroy(&scc.lock);
+    pthread_barrier_destroy(&scc.barrier);
+
+    for (u32 t = 0; t < n_threads; t++) {
+        m_arena_release(&scc.workers[t].arena);
+    }
+    free(scc.partitions);
+    m_arena_clear(graph->scratch_arena);
+    return sccs;
+}
+
+/*
+ * Node renumbering. Every strategy fills order with the old ids in their new order, so order[i] is the
+ * node that gets id i. The searches use order as their queue, and new_id, which starts out as all
+ * NAG_UNDISCOVERED, to mark the nodes already placed.
+ */
+static NAG_EdgeIdx *nag_total_degrees(NAG_Graph *graph)
+{
+    NAG_Graph reversed = nag_transpose(graph);
+    NAG_EdgeIdx *degree = m_arena_alloc(graph->scratch_arena, sizeof(NAG_EdgeIdx) * graph->n_nodes);
+    for (NAG_Idx node = 0; node < graph->n_nodes; node++) {
+        degree[node] = graph->offsets[node + 1] - graph->offsets[node] + reversed.offsets[node + 1] -
+                       reversed.offsets[node];
+    }
+    return degree;
+}
+
+/*
+ * Stable counting sort of all nodes by degree. Degrees above n_nodes can only come from duplicate
+ * edges and are counted as n_nodes, so the counts take no more room than the nodes.
+ */
+static void nag_sort_nodes_by_degree(NAG_Graph *graph, NAG_EdgeIdx *degree, bool descending, NAG_Idx *sorted)
+{
+    size_t max_key = graph->n_nodes;
+    size_t *count = m_arena_alloc_zero(graph->scratch_arena, sizeof(size_t) * (max_key + 2));
+    for (NAG_Idx node = 0; node < graph->n_nodes; node++) {
+        size_t key = NAG_MIN((size_t)degree[node], max_key);
+        count[(descending ? max_key - key : key) + 1]++;
+    }
+    for (size_t i = 1; i < max_key + 2; i++) {
+        count[i] += count[i - 1];
+    }
+    for (NAG_Idx node = 0; node < graph->n_nodes; node++) {
+        size_t key = NAG_MIN((size_t)degree[node], max_key);
+        sorted[count[descending ? max_key - key : key]++] = node;
+    }
+}
+
+/*
+ * Stable sort of nodes by ascending degree. Insertion sorts runs of 16, then merges them bottom-up,
+ * back and forth between nodes and tmp, which must have room for n nodes.
+ */
+static void nag_sort_by_degree(NAG_Idx *nodes, size_t n, NAG_EdgeIdx *degree, NAG_Idx *tmp)
+{
+    for (size_t run = 0; run < n; run += 16) {
+        size_t run_end = NAG_MIN(run + 16, n);
+        for (size_t i = run + 1; i < run_end; i++) {
+            NAG_Idx node = nodes[i];
+            size_t j = i;
+            for (; j > run && degree[nodes[j - 1]] > degree[node]; j--) {
+                nodes[j] = nodes[j - 1];
+            }
+            nodes[j] = node;
+        }
+    }
+
+    NAG_Idx *src = nodes;
+    NAG_Idx *dst = tmp;
+    for (size_t width = 16; width < n; width *= 2) {
+        for (size_t lo = 0; lo < n; lo += 2 * width) {
+            size_t mid = NAG_MIN(lo + width, n);
+            size_t hi = NAG_MIN(lo + 2 * width, n);
+            size_t i = lo, j = mid, k = lo;
+            while (i < mid && j < hi) {
+                dst[k++] = degree[src[j]] < degree[src[i]] ? src[j++] : src[i++];
+            }
+            while (i < mid) {
+                dst[k++] = src[i++];
+            }
+            while (j < hi) {
+                dst[k++] = src[j++];
+            }
+        }
+        NAG_Idx *swap = src;
+        src = dst;
+        dst = swap;
+    }
+    if (src != nodes) {
+        memcpy(nodes, src, sizeof(NAG_Idx) * n);
+    }
+}
+
+static void nag_reorder_bfs(NAG_Graph *graph, NAG_Idx *order, NAG_Idx *new_id)
+{
+    size_t head = 0;
+    size_t tail = 0;
+    for (NAG_Idx start = 0; start < graph->n_nodes; start++) {
+        if (new_id[start] != NAG_UNDISCOVERED) {
+            continue;
+        }
+        new_id[start] = tail;
+        order[tail++] = start;
+        while (head < tail) {
+            NAG_Idx node = order[head++];
+            for (NAG_EdgeIdx e = graph->offsets[node]; e < graph->offsets[node + 1]; e++) {
+                NAG_Idx neighbor = graph->targets[e];
+                if (new_id[neighbor] == NAG_UNDISCOVERED) {
+                    new_id[neighbor] = tail;
+                    order[tail++] = neighbor;
+                }
+            }
+        }
+    }
+}
+
+/*
+ * Cuthill-McKee treats the graph as undirected: a BFS over both edge directions from a node of lowest
+ * degree, that visits the unplaced neighbors of every node by ascending degree. Reversing the result
+ * puts the nodes with the most neighbors still ahead of them first, which tends to do better.
+ */
+static void nag_reorder_rcm(NAG_Graph *graph, NAG_Idx *order, NAG_Idx *new_id)
+{
+    NAG_Graph reversed = nag_transpose(graph);
+    NAG_EdgeIdx *degree = nag_total_degrees(graph);
+    NAG_Idx *starts = m_arena_alloc(graph->scratch_arena, sizeof(NAG_Idx) * graph->n_nodes);
+    NAG_Idx *tmp = m_arena_alloc(graph->scratch_arena, sizeof(NAG_Idx) * graph->n_nodes);
+    nag_sort_nodes_by_degree(graph, degree, false, starts);
+
+    size_t head = 0;
+    size_t tail = 0;
+    for (NAG_Idx i = 0; i < graph->n_nodes; i++) {
+        NAG_Idx start = starts[i];
+        if (new_id[start] != NAG_UNDISCOVERED) {
+            continue;
+        }
+        new_id[start] = tail;
+        order[tail++] = start;
+        while (head < tail) {
+            NAG_Idx node = order[head++];
+            size_t batch = tail;
+            NAG_Graph *directions[2] = { graph, &reversed };
+            for (u32 d = 0; d < 2; d++) {
+                NAG_Graph *g = directions[d];
+                for (NAG_EdgeIdx e = g->offsets[node]; e < g->offsets[node + 1]; e++) {
+                    NAG_Idx neighbor = g->targets[e];
+                    if (new_id[neighbor] == NAG_UNDISCOVERED) {
+                        new_id[neighbor] = tail;
+                        order[tail++] = neighbor;
+                    }
+                }
+            }
+            nag_sort_by_degree(order + batch, tail - batch, degree, tmp);
+        }
+    }
+
+    for (size_t i = 0, j = (size_t)graph->n_nodes; i + 1 < j; i++, j--) {
+        NAG_Idx swap = order[i];
+        order[i] = order[j - 1];
+        order[j - 1] = swap;
+    }
+}
+
+NAG_Reordering nag_reorder(NAG_Graph *graph, NAG_ReorderStrategy strategy)
+{
+    assert(graph->targets != NULL && "graph must be frozen");
+    NAG_Reordering result;
+    result.old_id = m_arena_alloc(graph->persist_arena, sizeof(NAG_Idx) * graph->n_nodes);
+    result.new_id = m_arena_alloc(graph->persist_arena, sizeof(NAG_Idx) * graph->n_nodes);
+    memset(result.new_id, 0xff, sizeof(NAG_Idx) * graph->n_nodes); /* NAG_UNDISCOVERED has all bits set */
+
+    switch (strategy) {
+    case NAG_REORDER_BFS:
+        nag_reorder_bfs(graph, result.old_id, result.new_id);
+        break;
+    case NAG_REORDER_RCM:
+        nag_reorder_rcm(graph, result.old_id, result.new_id);
+        break;
+    case NAG_REORDER_DEGREE:
+        nag_sort_nodes_by_degree(graph, nag_total_degrees(graph), true, result.old_id);
+        break;
+    }
+    for (NAG_Idx i = 0; i < graph->n_nodes; i++) {
+        result.new_id[result.old_id[i]] = i;
+    }
+
+    /* Same single allocation for both CSR arrays as nag_make_graph_from_edges() */
+    NAG_Graph *copy = &result.graph;
+    *copy = (NAG_Graph){ .n_nodes = graph->n_nodes, .n_edges = graph->n_edges,
+                         .scratch_arena = graph->scratch_arena, .persist_arena = graph->persist_arena };
+    size_t offsets_len = (size_t)graph->n_nodes + 1;
+    void *csr =
+        m_arena_alloc(graph->persist_arena, sizeof(NAG_EdgeIdx) * offsets_len + sizeof(NAG_Idx) * graph->n_edges);
+    copy->offsets = csr;
+    copy->targets = (NAG_Idx *)(copy->offsets + offsets_len);
+    if (graph->node_weights != NULL) {
+        copy->node_weights = m_arena_alloc(graph->persist_arena, sizeof(NAG_Weight) * graph->n_nodes);
+    }
+    if (graph->edge_weights != NULL) {
+        copy->edge_weights = m_arena_alloc(graph->persist_arena, sizeof(NAG_Weight) * graph->n_edges);
+    }
+
+    NAG_EdgeIdx edge = 0;
+    for (NAG_Idx i = 0; i < graph->n_nodes; i++) {
+        NAG_Idx node = result.old_id[i];
+        copy->offsets[i] = edge;
+        for (NAG_EdgeIdx e = graph->offsets[node]; e < graph->offsets[node + 1]; e++) {
+            copy->targets[edge] = result.new_id[graph->targets[e]];
+            if (copy->edge_weights != NULL) {
+                copy->edge_weights[edge] = graph->edge_weights[e];
+            }
+            edge++;
+        }
+        if (copy->node_weights != NULL) {
+            copy->node_weights[i] = graph->node_weights[node];
+        }
+    }
+    copy->offsets[graph->n_nodes] = edge;
+
+    m_arena_clear(graph->scratch_arena);
+    return result;
 }
@@ -61,18 +61,68 @@ typedef double f64;
 #include "sac_single.h"
 
 
-/* 
+/*
  * The index type.
- * If u16 does not suffice, just change this typedef.
+ * Selected at build time with -DNAG_IDX_BITS=16, 32 or 64. Defaults to 16 as it is the most cache
+ * dense. The largest value of the type is reserved for NAG_UNDISCOVERED, so a graph can hold at most
+ * NAG_IDX_MAX nodes.
+ *
+ * NAG_EdgeIdx indexes into the edge arrays of a frozen graph and must be able to hold the total
+ * number of edges. Defaults to 32 bits, or 64 bits when NAG_IDX_BITS is 64. Can be overridden with
+ * -DNAG_EDGE_IDX_BITS=32 or 64.
  */
+#ifndef NAG_IDX_BITS
+#define NAG_IDX_BITS 16
+#endif
+
+#if NAG_IDX_BITS == 16
 typedef u16 NAG_Idx;
+#define NAG_IDX_MAX U16_MAX
+#elif NAG_IDX_BITS == 32
+typedef u32 NAG_Idx;
+#define NAG_IDX_MAX U32_MAX
+#elif NAG_IDX_BITS == 64
+typedef u64 NAG_Idx;
+#define NAG_IDX_MAX U64_MAX
+#else
+#error "NAG_IDX_BITS must be 16, 32 or 64"
+#endif
+
+#ifndef NAG_EDGE_IDX_BITS
+#if NAG_IDX_BITS == 64
+#define NAG_EDGE_IDX_BITS 64
+#else
+#define NAG_EDGE_IDX_BITS 32
+#endif
+#endif
+
+#if NAG_EDGE_IDX_BITS == 32
+typedef u32 NAG_EdgeIdx;
+#elif NAG_EDGE_IDX_BITS == 64
+typedef u64 NAG_EdgeIdx;
+#else
+#error "NAG_EDGE_IDX_BITS must be 32 or 64"
+#endif
+
+#define NAG_STACK_GROW_SIZE (size_t)256 // at least 8
+#define NAG_QUEUE_GROW_SIZE (size_t)32 // at least 8
+
+/* Direction switching thresholds for nag_bfs_levels(). See Beamer et al. */
+#define NAG_BFS_ALPHA 14 // go bottom-up when the frontier has more than 1/ALPHA of the unexplored edges
+#define NAG_BFS_BETA 24 // go back top-down when the frontier has less than 1/BETA of the nodes
+
+/* How many frontier nodes a worker claims at a time in the parallel algorithms */
+#define NAG_PARALLEL_CHUNK_SIZE (size_t)64
+/* nag_scc_parallel() finishes partitions this small with a sequential Tarjan instead of splitting them */
+#define NAG_SCC_TARJAN_THRESHOLD (size_t)4096
 
-#define NAG_STACK_GROW_SIZE (NAG_Idx)256 // at least 8
-#define NAG_QUEUE_GROW_SIZE (NAG_Idx)32 // at least 8
-                                        //
 #define NAG_MIN(a, b) ((a) < (b) ? (a) : (b))
+#define NAG_MAX(a, b) ((a) > (b) ? (a) : (b))
+
+#define NAG_UNDISCOVERED NAG_IDX_MAX
 
-#define NAG_UNDISCOVERED U16_MAX
+/* Weights are costs, e.g. the estimated time to compile a module */
+typedef u64 NAG_Weight;
 
 typedef struct nag_graph_node_t NAG_GraphNode;
 struct nag_graph_node_t {
@@ -82,7 +132,24 @@ struct nag_graph_node_t {
 
 typedef struct {
     NAG_Idx n_nodes;
+    NAG_EdgeIdx n_edges;
     NAG_GraphNode **neighbor_list;
+    /*
+     * Compressed sparse row (CSR) layout built by nag_freeze().
+     * The neighbors of node i are targets[offsets[i]] .. targets[offsets[i + 1] - 1].
+     * Both are NULL until the graph is frozen.
+     */
+    NAG_EdgeIdx *offsets; // of n_nodes + 1 len
+    NAG_Idx *targets; // of n_edges len
+    /* Same layout with every edge reversed. Built on demand by nag_transpose(), NULL until then */
+    NAG_EdgeIdx *rev_offsets; // of n_nodes + 1 len
+    NAG_Idx *rev_targets; // of n_edges len
+    /* Optional weights, NULL until the first one is set. Nodes weigh 1 and edges 0 by default */
+    NAG_Weight *node_weights; // of n_nodes len
+    NAG_Weight *edge_weights; // of n_edges len, in the same order as targets
+    /* The file offsets and targets point into when loaded by nag_load_mmap(), NULL otherwise */
+    void *mapping;
+    size_t mapping_size;
     Arena *scratch_arena;
     Arena *persist_arena;
 } NAG_Graph;
@@ -92,27 +159,365 @@ typedef struct {
     NAG_Idx *nodes; // of n_nodes len
 } NAG_Order;
 
+/*
+ * Adds edges to an unfrozen graph from one thread while other threads do the same through their own
+ * inserters. Edge nodes go on the arena of the inserter, so threads never share an allocator, and are
+ * pushed onto the neighbor list of their source with a compare-and-swap.
+ */
+typedef struct {
+    NAG_Graph *graph;
+    Arena *arena; // must outlive the graph, or at least last until nag_freeze() has copied the edges
+    NAG_EdgeIdx n_edges; // added by this inserter, not yet counted in graph->n_edges
+} NAG_EdgeInserter;
+
+/*
+ * Snapshot files written by nag_save(). A 64 byte header followed by the offsets and targets of the
+ * CSR exactly as they are laid out in memory, each starting at a multiple of 8 bytes, so a mapped
+ * file can be used in place. Files are only portable between builds with the same index widths and
+ * byte order, which the header records.
+ */
+#define NAG_SNAPSHOT_MAGIC "NAGGRAPH"
+#define NAG_SNAPSHOT_VERSION 1
+
+typedef enum {
+    NAG_LOAD_OK,
+    NAG_LOAD_IO_ERROR, // open, fstat or mmap failed, errno tells why
+    NAG_LOAD_NOT_A_SNAPSHOT, // wrong magic or too small to hold a header
+    NAG_LOAD_WRONG_VERSION,
+    NAG_LOAD_WRONG_LAYOUT, // saved with another NAG_IDX_BITS, NAG_EDGE_IDX_BITS or byte order
+    NAG_LOAD_CORRUPT, // truncated, a checksum does not match, or the CSR is not well formed
+    NAG_LOAD_MALFORMED, // an edge list has lines that could not be parsed
+    NAG_LOAD_TOO_LARGE, // an edge list has more edges than NAG_EdgeIdx can count
+} NAG_LoadStatus;
+
+typedef struct {
+    u64 n_lines; // malformed lines
+    size_t first_offset; // byte offset in the file of the first of them
+} NAG_ParseErrors;
+
+/*
+ * State for running many single-source queries on the same graph. A node counts as visited when
+ * its stamp equals the epoch of the current query, so starting a new query is a single increment.
+ * The stamps are only cleared when the epoch wraps around.
+ * Queries only read the graph and only write to their own state and arenas, so threads can query the
+ * same frozen graph at once as long as each has its own NAG_Query made with nag_make_query_on().
+ */
+typedef struct {
+    NAG_Graph *graph;
+    u32 epoch;
+    u32 *visited; // of graph->n_nodes len
+    Arena *persist_arena; // where results go
+    Arena *scratch_arena;
+} NAG_Query;
+
+typedef enum {
+    NAG_VISIT_DISCOVER, // the node is reached for the first time
+    NAG_VISIT_FINISH, // all neighbors of the node have been handled
+} NAG_VisitEvent;
+
+/* Called for every traversal event. Return false to stop the traversal */
+typedef bool (*NAG_Visitor)(NAG_Idx node, NAG_VisitEvent event, void *ctx);
+
+typedef struct {
+    NAG_Order order; // the reached nodes, level by level
+    NAG_Idx *depth; // of n_nodes len. NAG_UNDISCOVERED for nodes that were not reached
+} NAG_BfsLevels;
+
+/*
+ * A reversed topological order that is kept up to date as edges are added, using the algorithm of
+ * Pearce and Kelly. Only the nodes between the two endpoints of an edge in the current order are
+ * ever searched or moved.
+ */
+typedef struct {
+    NAG_Graph *graph;
+    NAG_GraphNode **rev_list; // incoming edges of each node, on the persist arena
+    NAG_Order order; // leaf-first, same as nag_rev_toposort()
+    NAG_Idx *position; // of n_nodes len. order.nodes[position[node]] == node
+    NAG_Query query;
+} NAG_DynTopo;
+
+/*
+ * The graph with every SCC contracted into a single node.
+ * SCC ids are numbered in reverse topological order: every edge of the dag goes from a higher id to
+ * a lower id, so 0 .. dag.n_nodes - 1 is a leaf-first build order of the SCCs.
+ */
+typedef struct {
+    NAG_Idx *component; // of n_nodes len. The SCC id of each node of the original graph
+    /* The nodes of SCC i are members[member_offsets[i]] .. members[member_offsets[i + 1] - 1] */
+    NAG_Idx *members; // of n_nodes len
+    NAG_Idx *member_offsets; // of dag.n_nodes + 1 len
+    NAG_Graph dag; // frozen, with at most one edge between any two SCCs
+} NAG_Condensation;
+
+typedef enum {
+    NAG_REORDER_BFS, // breadth-first along the edges, so nodes are numbered close to where they are reached
+    NAG_REORDER_RCM, // reverse Cuthill-McKee, which keeps the ids of neighbors (either direction) close
+    NAG_REORDER_DEGREE, // by in + out degree, highest first, so the hubs share cache lines
+} NAG_ReorderStrategy;
+
+/* A renumbered copy of a graph. Node i of the original is node new_id[i] of the copy */
+typedef struct {
+    NAG_Graph graph; // frozen
+    NAG_Idx *new_id; // of n_nodes len. The forward permutation, old id -> new id
+    NAG_Idx *old_id; // of n_nodes len. The inverse permutation, new id -> old id
+} NAG_Reordering;
+
+typedef struct {
+    NAG_Order order; // leaf-first, level by level
+    /* Level i is order.nodes[level_offsets[i]] .. order.nodes[level_offsets[i + 1] - 1] */
+    NAG_Idx *level_offsets; // of n_levels + 1 len
+    NAG_Idx n_levels; // the length of the critical path, in nodes
+    NAG_Idx max_width; // the size of the largest level
+} NAG_TopoLevels;
+
+/* Runs the task of a node. Called concurrently from many threads. Return false to cancel the execution */
+typedef bool (*NAG_Task)(NAG_Idx node, void *ctx);
+
+typedef struct {
+    NAG_Idx n_completed; // tasks that ran and returned true
+    NAG_Idx failed; // the first task that returned false, or NAG_UNDISCOVERED
+} NAG_Execution;
+
+/*
+ * A node can start once every neighbor has finished and the weight of the edge to it has passed, and
+ * finishes its own weight later.
+ */
+typedef struct {
+    NAG_Order path; // leaf-first, the chain of nodes that finishes last
+    NAG_Weight length; // when the last node finishes
+    NAG_Weight *earliest_start; // of n_nodes len
+    NAG_Weight *slack; // of n_nodes len. How much a node can be delayed without increasing length
+} NAG_CriticalPath;
+
 typedef struct {
     u32 n; // how many orders
     NAG_Order *orders; // NOTE: Heap allocated!
 } NAG_OrderList;
 
+/*
+ * The same as NAG_OrderList, but every order is in one buffer on an arena chosen by the caller.
+ * Order i is nodes[offsets[i]] .. nodes[offsets[i + 1] - 1].
+ */
+typedef struct {
+    NAG_Idx n; // how many orders
+    NAG_Idx *offsets; // of n + 1 len, room for n_nodes + 1
+    NAG_Idx *nodes; // of offsets[n] len, room for n_nodes
+} NAG_FlatOrderList;
+
 
 NAG_Graph nag_make_graph(Arena *persist, Arena *scratch, NAG_Idx n_nodes);
 /* Expects node indices between 0 and graph->n_nodes - 1 */
 void nag_add_edge(NAG_Graph *graph, NAG_Idx from, NAG_Idx to);
+NAG_EdgeInserter nag_make_edge_inserter(NAG_Graph *graph, Arena *arena);
+/* Safe to call concurrently with other inserters of the same graph, but not with nag_add_edge() */
+void nag_add_edge_concurrent(NAG_EdgeInserter *inserter, NAG_Idx from, NAG_Idx to);
+/*
+ * Counts the edges of the inserter into the graph. Call for every inserter once the threads are
+ * joined, before the graph is used. The order of neighbors depends on how the threads interleaved.
+ */
+void nag_finish_edge_inserter(NAG_EdgeInserter *inserter);
+/*
+ * Adds the edge only if it does not close a cycle, and returns whether it was added. Otherwise cycle
+ * is set to a shortest cycle the edge would close, on the persist arena: from, to, and then the path
+ * back to from, where every node has an edge to the next and the last has an edge to from.
+ * Only searches the nodes reachable from to, and stops as soon as from is found.
+ */
+bool nag_add_edge_checked(NAG_Graph *graph, NAG_Idx from, NAG_Idx to, NAG_Order *cycle);
+/*
+ * Packs the adjacency lists into one contiguous offsets array and one contiguous targets array
+ * on the persist arena. Neighbor order is kept as is. All algorithms below run on the packed
+ * layout once the graph is frozen. No edges can be added to a frozen graph.
+ */
+void nag_freeze(NAG_Graph *graph);
+/*
+ * Builds an already frozen graph from the edges from[i] -> to[i] with a counting sort in two linear
+ * passes. The CSR arrays are allocated in one go on the persist arena. Neighbors keep the order they
+ * appear in the input, unlike nag_add_edge() which yields reverse insertion order.
+ */
+NAG_Graph nag_make_graph_from_edges(Arena *persist, Arena *scratch, NAG_Idx n_nodes, const NAG_Idx *from,
+                                    const NAG_Idx *to, NAG_EdgeIdx n_edges);
+/*
+ * Returns a frozen graph with every edge of the given frozen graph reversed. The reverse CSR is built
+ * on the persist arena the first time and cached in the graph. The returned graph shares its arrays
+ * and arenas with the original, so transposing it again gives the original graph. Edge weights are
+ * left out, as they follow the order of the original edges.
+ */
+NAG_Graph nag_transpose(NAG_Graph *graph);
 void nag_print(NAG_Graph *graph);
 
+/*
+ * Writes the CSR of a frozen graph to path. The file is written next to path and renamed over it, so
+ * a concurrent nag_load_mmap() sees either the old or the new snapshot. Weights and the transpose are
+ * not saved. Returns false and leaves errno set if the file could not be written.
+ */
+bool nag_save(NAG_Graph *graph, const char *path);
+/*
+ * Maps a snapshot read-only and sets graph to a frozen graph whose offsets and targets point straight
+ * into the mapping. Nothing is parsed or copied, so pages are only read from disk (or the page cache)
+ * once an algorithm touches them. The header is always checked. With verify the whole file is read
+ * once to check the payload checksum and that every offset and target is in range. Only skip it for
+ * files that can be trusted, as the algorithms do not bounds check a malformed CSR.
+ * Everything the algorithms allocate goes on persist and scratch as usual. Release with nag_unmap().
+ */
+NAG_LoadStatus nag_load_mmap(Arena *persist, Arena *scratch, const char *path, bool verify, NAG_Graph *graph);
+/* Unmaps a graph loaded by nag_load_mmap(). Graphs nag_transpose() returned for it share the mapping */
+void nag_unmap(NAG_Graph *graph);
+/*
+ * Builds a frozen graph from a text file with one edge per line: two node indices separated by spaces or
+ * tabs, e.g. "12 7" for the edge 12 -> 7. Empty lines and lines starting with # are skipped, and the graph
+ * gets max index + 1 nodes. The file is mapped, split in chunks at line breaks, and each of the n_threads
+ * workers (the calling thread included) parses its chunk straight into the edge arrays that
+ * nag_make_graph_from_edges() then packs. If not every thread can be created, the file is split between
+ * the workers that were. A line with anything else, or an index NAG_Idx can not hold, is malformed. If
+ * there are any, nothing is built, NAG_LOAD_MALFORMED is returned and errors tells how many there were
+ * and where the first starts. errors can be NULL. Neighbors keep the order of the file.
+ */
+NAG_LoadStatus nag_load_edge_list(Arena *persist, Arena *scratch, const char *path, u32 n_threads, NAG_Graph *graph,
+                                  NAG_ParseErrors *errors);
+
+void nag_set_node_weight(NAG_Graph *graph, NAG_Idx node, NAG_Weight weight);
+/* Sets the weight of the first edge from -> to, which must exist. Requires a frozen graph */
+void nag_set_edge_weight(NAG_Graph *graph, NAG_Idx from, NAG_Idx to, NAG_Weight weight);
+
+/* Allocates the visited stamps on the persist arena. The query uses the arenas of the graph */
+NAG_Query nag_make_query(NAG_Graph *graph);
+/*
+ * A query with its own arenas, e.g. one per thread. The visited stamps go on persist. If the graph is
+ * frozen its transpose is built here, so that no query ever writes to the graph. Make the queries
+ * before the threads start querying.
+ */
+NAG_Query nag_make_query_on(NAG_Graph *graph, Arena *persist, Arena *scratch);
+
 NAG_OrderList nag_dfs(NAG_Graph *graph);
 NAG_Order nag_dfs_from(NAG_Graph *graph, NAG_Idx start_node);
+/* Same as nag_dfs_from(), but costs time proportional to the nodes reached instead of the graph size */
+NAG_Order nag_query_dfs_from(NAG_Query *query, NAG_Idx start_node);
 
 NAG_OrderList nag_bfs(NAG_Graph *graph);
 NAG_Order nag_bfs_from(NAG_Graph *graph, NAG_Idx start_node);
+NAG_Order nag_query_bfs_from(NAG_Query *query, NAG_Idx start_node);
+
+/*
+ * Same as nag_dfs(), nag_bfs() and nag_scc(), but the result is allocated up front on the given arena,
+ * which must not be the scratch arena of the graph. Nothing is heap allocated, so there is nothing to free.
+ */
+NAG_FlatOrderList nag_dfs_flat(NAG_Graph *graph, Arena *arena);
+NAG_FlatOrderList nag_bfs_flat(NAG_Graph *graph, Arena *arena);
+NAG_FlatOrderList nag_scc_flat(NAG_Graph *graph, Arena *arena);
+/* A view of order i, pointing into list */
+NAG_Order nag_flat_order(NAG_FlatOrderList *list, NAG_Idx i);
+/* Same as nag_add_edge_checked(), but costs time proportional to the nodes searched */
+bool nag_query_add_edge_checked(NAG_Query *query, NAG_Idx from, NAG_Idx to, NAG_Order *cycle);
+
+/*
+ * Streaming traversals. Instead of building an order, every discover and finish event is passed to
+ * the visitor, which can stop the traversal early. Returns true if the visitor stopped it.
+ * In BFS a node is discovered when it is first seen as a neighbor, and finished once all its
+ * neighbors have been seen.
+ */
+bool nag_dfs_visit(NAG_Query *query, NAG_Idx start_node, NAG_Visitor visitor, void *ctx);
+bool nag_bfs_visit(NAG_Query *query, NAG_Idx start_node, NAG_Visitor visitor, void *ctx);
+
+/* Returns true if target_node is reachable from start_node. Stops as soon as it is found */
+bool nag_dfs_from_to(NAG_Graph *graph, NAG_Idx start_node, NAG_Idx target_node);
+bool nag_bfs_from_to(NAG_Graph *graph, NAG_Idx start_node, NAG_Idx target_node);
+bool nag_query_dfs_from_to(NAG_Query *query, NAG_Idx start_node, NAG_Idx target_node);
+bool nag_query_bfs_from_to(NAG_Query *query, NAG_Idx start_node, NAG_Idx target_node);
+
+/*
+ * Bidirectional BFS. Expands forward from start_node and backward from target_node, one level at a
+ * time on the side with the smaller frontier, until the two searches meet. Returns a shortest path
+ * from start_node to target_node (both included) on the persist arena, or an empty order if there
+ * is none. Requires a frozen graph, as the backward search uses nag_transpose().
+ */
+NAG_Order nag_shortest_path(NAG_Graph *graph, NAG_Idx start_node, NAG_Idx target_node);
+NAG_Order nag_query_shortest_path(NAG_Query *query, NAG_Idx start_node, NAG_Idx target_node);
+
+/*
+ * Direction-optimizing BFS. Level-synchronous, and switches to bottom-up steps over nag_transpose()
+ * when the frontier grows large, where each unreached node looks for any parent in a bitmap of the
+ * frontier instead of the frontier scanning all its edges. Returns the BFS order and the depth of
+ * every node on the persist arena. Within a level the order may differ from nag_bfs_from().
+ * Requires a frozen graph.
+ */
+NAG_BfsLevels nag_bfs_levels(NAG_Graph *graph, NAG_Idx start_node);
+
+/*
+ * Level-synchronous BFS on n_threads threads (including the calling thread). Each level the frontier
+ * is split in chunks that workers claim, and nodes are claimed with an atomic test-and-set on a
+ * visited bitmap. Every worker collects its part of the next frontier on its own arena before they
+ * are merged. Returns the same as nag_bfs_levels(), except that nodes within a level can come in any
+ * order. Requires a frozen graph.
+ */
+NAG_BfsLevels nag_bfs_parallel(NAG_Graph *graph, NAG_Idx start_node, u32 n_threads);
 
 /* Assumes graph contains no cycles */
 NAG_Order nag_rev_toposort(NAG_Graph *graph);
 
+/*
+ * Kahn's algorithm, leaf-first. Level 0 is the nodes without outgoing edges, and every other node is
+ * one level above the highest of its neighbors. All nodes of a level only depend on nodes of lower
+ * levels, so they can be processed concurrently. Nodes on or depending on a cycle are never reached,
+ * so order.n_nodes < graph->n_nodes means the graph has a cycle. Requires a frozen graph.
+ */
+NAG_TopoLevels nag_topo_levels(NAG_Graph *graph);
+
+/*
+ * Longest path through the dag using the node and edge weights, found with one pass over the
+ * nag_topo_levels() order and one pass back. The nodes on the critical path have no slack, and
+ * shortening any of them shortens the whole. Assumes graph contains no cycles. Requires a frozen graph.
+ */
+NAG_CriticalPath nag_critical_path(NAG_Graph *graph);
+
+/*
+ * Runs task for every node on n_threads threads (including the calling thread), each one only after
+ * the tasks of all its neighbors have completed. Every node has an atomic counter of neighbors left
+ * to complete, and the worker that brings it to zero pushes the node on its own work-stealing deque.
+ * Idle workers steal from the others. Once a task fails no new tasks are started, tasks already
+ * running are left to finish. Nodes on or depending on a cycle never run, so n_completed <
+ * graph->n_nodes without a failed task means the graph has a cycle. Requires a frozen graph.
+ */
+NAG_Execution nag_execute(NAG_Graph *graph, u32 n_threads, NAG_Task task, void *ctx);
+
+/*
+ * Starts maintaining the reversed topological order of an unfrozen graph. Edges already in the
+ * graph are included, and like nag_rev_toposort() they must not form a cycle.
+ */
+NAG_DynTopo nag_make_dyn_topo(NAG_Graph *graph);
+/*
+ * Adds the edge to the graph and updates topo->order in place. If the edge would close a cycle, it is
+ * not added, the order is left untouched and false is returned.
+ */
+bool nag_dyn_topo_add_edge(NAG_DynTopo *topo, NAG_Idx from, NAG_Idx to);
+
 NAG_OrderList nag_scc(NAG_Graph *graph);
+/*
+ * Same result as nag_scc(), computed on n_threads threads (including the calling thread). Nodes that
+ * can not be part of a non-trivial SCC are trimmed in parallel first, and the rest is split up with
+ * forward-backward searches from random pivots whose independent partitions are trimmed again and
+ * processed concurrently, down to small partitions that are finished with Tarjan. With one thread it
+ * is nag_scc(). The order of the SCCs, and of the nodes within each SCC, is not deterministic.
+ * Requires a frozen graph.
+ */
+NAG_OrderList nag_scc_parallel(NAG_Graph *graph, u32 n_threads);
+
+/*
+ * One Tarjan pass that also keeps the trivial SCCs. Returns the SCC of every node and the condensed
+ * dag with deduplicated edges, all on the persist arena. Works on graphs with cycles, unlike
+ * nag_rev_toposort(), as the SCC ids themselves are a reversed topological order.
+ */
+NAG_Condensation nag_condense(NAG_Graph *graph);
+
+/*
+ * Renumbers the nodes of a frozen graph for locality, so the per-node arrays the algorithms index
+ * (visited, low links, depths, ...) are scanned close to in order instead of at random. RCM and
+ * degree build the transpose with nag_transpose(). The searches start over from the node with the
+ * lowest old id (lowest degree for RCM) not placed yet, so every node gets an id. Each node keeps the
+ * order of its neighbors, and weights move with their nodes and edges. Everything is allocated on the
+ * persist arena, and the copy uses the same arenas as the original. Run the algorithms on the copy
+ * and map results back with old_id, e.g. old_id[order.nodes[i]].
+ */
+NAG_Reordering nag_reorder(NAG_Graph *graph, NAG_ReorderStrategy strategy);
 
 
 
@@ -52,6 +52,30 @@ typedef struct m_arena_tmp ArenaTmp;
 /* types */
 typedef struct m_arena Arena;
 typedef struct m_arena_tmp ArenaTmp;
+typedef struct m_arena_stats ArenaStats;
+typedef struct m_arena_policy ArenaPolicy;
+
+/*
+ * usage statistics of an arena. only counted when the implementation is compiled with SAC_STATS,
+ * otherwise they stay zero. the layout does not depend on it.
+ */
+struct m_arena_stats {
+    size_t peak_offset; // highest offset reached. survives m_arena_clear() and m_arena_tmp_release()
+    size_t commits; // calls to mprotect that committed pages
+    size_t bytes_requested; // sum of the sizes of all allocations
+    size_t alignment_loss; // bytes skipped to align allocations
+    size_t failed_allocs;
+};
+
+/*
+ * how a dynamic arena commits memory. the zero value commits exactly the pages needed.
+ */
+struct m_arena_policy {
+    size_t min_commit_pages; // never commit fewer pages than this at a time
+    bool geometric; // commit at least as many pages as are already committed, doubling the arena
+    bool huge_pages; // madvise(MADV_HUGEPAGE) the reserved region so it can be backed by huge pages
+    bool decommit_on_clear; // madvise(MADV_DONTNEED) the committed pages in m_arena_clear()
+};
 
 /*
  * generic memory arena that dynamically grows its committed size.
@@ -67,6 +91,8 @@ struct m_arena {
     };
     size_t page_size;
     size_t pages_commited; // how much of the backing memory is acutally "backing"
+    struct m_arena_policy policy;
+    struct m_arena_stats stats;
 };
 
 struct m_arena_tmp {
@@ -79,6 +105,7 @@ struct m_arena_tmp {
 void m_arena_init(struct m_arena *arena, void *backing_memory, size_t backing_length);
 void m_arena_init_dynamic(struct m_arena *arena, size_t starting_pages, size_t max_pages);
 void m_arena_release(struct m_arena *arena);
+void m_arena_set_policy(struct m_arena *arena, struct m_arena_policy policy);
 
 void *m_arena_alloc_internal(struct m_arena *arena, size_t size, size_t align, bool zero);
 #define m_arena_alloc(arena, size) m_arena_alloc_internal(arena, size, SAC_DEFAULT_ALIGNMENT, false)
@@ -96,6 +123,15 @@ void *m_arena_get(struct m_arena *arena, size_t byte_idx);
 #define m_arena_alloc_struct_zero(arena, type) (type *)m_arena_alloc_zero((arena), sizeof(type))
 #define m_arena_gett(arena, idx, type) (type *)m_arena_get((arena), sizeof(type) * (idx))
 
+struct m_arena_stats m_arena_stats_snapshot(struct m_arena *arena);
+/*
+ * measures what happens on the arena between begin and end, e.g. around a single call.
+ * end returns the counters accumulated since begin, and the peak offset reached since begin.
+ * the lifetime peak offset is kept.
+ */
+struct m_arena_stats m_arena_stats_begin(struct m_arena *arena);
+struct m_arena_stats m_arena_stats_end(struct m_arena *arena, struct m_arena_stats begin);
+
 
 struct m_arena_tmp m_arena_tmp_init(struct m_arena *arena);
 void m_arena_tmp_release(struct m_arena_tmp tmp);
@@ -134,6 +170,9 @@ static bool m_arena_commit(struct m_arena *arena, size_t pages_to_commit)
     if (rc == -1)
         return false;
 
+#ifdef SAC_STATS
+    arena->stats.commits++;
+#endif
     arena->pages_commited += pages_to_commit;
     return true;
 }
@@ -154,8 +193,15 @@ static bool m_arena_ensure_commited(struct m_arena *arena)
     if (arena->pages_commited + pages_to_commit > arena->max_pages)
         return false;
 
-    m_arena_commit(arena, pages_to_commit);
-    return true;
+    /* commit ahead of what is needed to save on mprotect calls, but never beyond max_pages */
+    if (arena->policy.geometric && pages_to_commit < arena->pages_commited)
+        pages_to_commit = arena->pages_commited;
+    if (pages_to_commit < arena->policy.min_commit_pages)
+        pages_to_commit = arena->policy.min_commit_pages;
+    if (arena->pages_commited + pages_to_commit > arena->max_pages)
+        pages_to_commit = arena->max_pages - arena->pages_commited;
+
+    return m_arena_commit(arena, pages_to_commit);
 }
 
 /*
@@ -195,6 +241,8 @@ void m_arena_init(struct m_arena *arena, void *backing_memory, size_t backing_le
     arena->memory = backing_memory;
     arena->backing_length = backing_length;
     arena->offset = 0;
+    arena->policy = (struct m_arena_policy){ 0 };
+    arena->stats = (struct m_arena_stats){ 0 };
 }
 
 void m_arena_init_dynamic(struct m_arena *arena, size_t starting_pages, size_t max_pages)
@@ -206,6 +254,8 @@ void m_arena_init_dynamic(struct m_arena *arena, size_t starting_pages, size_t m
     arena->page_size = sysconf(_SC_PAGE_SIZE);
     arena->offset = 0;
     arena->pages_commited = 0;
+    arena->policy = (struct m_arena_policy){ 0 };
+    arena->stats = (struct m_arena_stats){ 0 };
 
     arena->memory = mmap(NULL, arena->max_pages * arena->page_size, PROT_NONE,
                          MAP_PRIVATE | SAC_MAP_ANON, -1, 0);
@@ -223,9 +273,20 @@ void m_arena_release(struct m_arena *arena)
     assert(arena != NULL);
 
     /* the implementation does not manage the backing memory */
-    if (!arena->is_dynamic)
+    if (arena->is_dynamic)
+        munmap(arena->memory, arena->max_pages * arena->page_size);
+}
 
-        munmap(arena->memory, arena->max_pages);
+void m_arena_set_policy(struct m_arena *arena, struct m_arena_policy policy)
+{
+    assert(arena->is_dynamic);
+
+    arena->policy = policy;
+    /* advisory, so failing or missing support is fine */
+#ifdef MADV_HUGEPAGE
+    if (policy.huge_pages)
+        madvise(arena->memory, arena->max_pages * arena->page_size, MADV_HUGEPAGE);
+#endif
 }
 
 /*
@@ -243,6 +304,14 @@ void *m_arena_alloc_internal(struct m_arena *arena, size_t size, size_t alignmen
     arena->offset = offset + size;
 
     bool success = m_arena_ensure_commited(arena);
+#ifdef SAC_STATS
+    arena->stats.bytes_requested += size;
+    arena->stats.alignment_loss += offset - (curr_ptr - (uintptr_t)arena->memory);
+    if (!success)
+        arena->stats.failed_allocs++;
+    else if (arena->offset > arena->stats.peak_offset)
+        arena->stats.peak_offset = arena->offset;
+#endif
     if (!success)
         return NULL;
 
@@ -256,6 +325,9 @@ void *m_arena_alloc_internal(struct m_arena *arena, size_t size, size_t alignmen
 void m_arena_clear(struct m_arena *arena)
 {
     arena->offset = 0;
+    /* the pages stay committed, but the kernel takes back the memory and hands out zeroed pages on the next touch */
+    if (arena->is_dynamic && arena->policy.decommit_on_clear && arena->pages_commited != 0)
+        madvise(arena->memory, arena->pages_commited * arena->page_size, MADV_DONTNEED);
 }
 
 void *m_arena_get(struct m_arena *arena, size_t byte_idx)
@@ -275,4 +347,31 @@ void m_arena_tmp_release(struct m_arena_tmp tmp)
 {
     tmp.arena->offset = tmp.offset;
 }
+
+struct m_arena_stats m_arena_stats_snapshot(struct m_arena *arena)
+{
+    return arena->stats;
+}
+
+struct m_arena_stats m_arena_stats_begin(struct m_arena *arena)
+{
+    struct m_arena_stats begin = arena->stats;
+    /* the peak restarts from here, end puts the lifetime peak back */
+    arena->stats.peak_offset = arena->offset;
+    return begin;
+}
+
+struct m_arena_stats m_arena_stats_end(struct m_arena *arena, struct m_arena_stats begin)
+{
+    struct m_arena_stats since = {
+        .peak_offset = arena->stats.peak_offset,
+        .commits = arena->stats.commits - begin.commits,
+        .bytes_requested = arena->stats.bytes_requested - begin.bytes_requested,
+        .alignment_loss = arena->stats.alignment_loss - begin.alignment_loss,
+        .failed_allocs = arena->stats.failed_allocs - begin.failed_allocs,
+    };
+    if (begin.peak_offset > arena->stats.peak_offset)
+        arena->stats.peak_offset = begin.peak_offset;
+    return since;
+}
 #endif /* SAC_IMPLEMENTATION */